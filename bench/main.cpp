@@ -0,0 +1,72 @@
+#include <chrono>
+#include <cstdio>
+#include <vector>
+#include "dfu/enc.h"
+
+using namespace dfu;
+
+/**
+ * @brief Per-chunk decoding overhead: dfu::seq traversal, which builds 
+ * dfu::chunk and is switched on by caller, against dfu::visit(), which 
+ * calls type-specific handler straight from decoder.
+ * 
+ */
+int main(int, char**)
+{
+    using clock = std::chrono::steady_clock;
+
+    constexpr size_t chunks = 500000;
+    constexpr int rounds = 20;
+
+    std::vector<byte> buf(8 << 20);
+    size_t len = 0;
+    ref codec{buf, len};
+
+    for (size_t i = 0; i < chunks; ++i) {
+        switch (i % 5)
+        {
+        case 0: codec.encode_raw({0x01, 0x02, 0x03}); break;
+        case 1: codec.encode_rep(0x07, 5); break;
+        case 2: codec.encode_off(-int32_t(i % 1000), 9); break;
+        case 3: codec.encode_arr({0x01, 0x02}, 3); break;
+        default: codec.encode_cpy(i % 1000 + 1, 4);
+        }
+    }
+    const seq s{buf.data(), len, ext_cpy};
+
+    for (int r = 0; r < 3; ++r) {
+        size_t sum_seq = 0;
+        size_t sum_vis = 0;
+
+        auto t0 = clock::now();
+        for (int k = 0; k < rounds; ++k) {
+            for (auto cnk : s) {
+                switch (cnk.type)
+                {
+                case type_raw: sum_seq += cnk.size; break;
+                case type_rep: sum_seq += cnk.rep; break;
+                case type_arr: sum_seq += cnk.size * cnk.arr.reps; break;
+                case type_off: sum_seq += cnk.off; break;
+                case type_cpy: sum_seq += cnk.cpy; break;
+                default:;
+                }
+            }
+        }
+        auto t1 = clock::now();
+        for (int k = 0; k < rounds; ++k) {
+            visit(s, 
+                [&](pointer, size_t size)               { sum_vis += size; },
+                [&](byte val, size_t)                   { sum_vis += val; },
+                [&](pointer, size_t size, size_t n)     { sum_vis += size * n; },
+                [&](int32_t off, size_t)                { sum_vis += off; },
+                [&](uint32_t dist, size_t)              { sum_vis += dist; });
+        }
+        auto t2 = clock::now();
+
+        const double total = double(chunks) * rounds;
+        std::printf("seq %6.2f ns/chunk, visit %6.2f ns/chunk%s\n", 
+            std::chrono::duration<double, std::nano>(t1 - t0).count() / total,
+            std::chrono::duration<double, std::nano>(t2 - t1).count() / total,
+            sum_seq == sum_vis ? "" : " (mismatch)");
+    }
+}
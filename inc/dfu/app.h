@@ -0,0 +1,220 @@
+#ifndef DFU_APP_H
+#define DFU_APP_H
+
+#include "dfu/dec.h"
+#include <algorithm>
+#include <concepts>
+
+namespace dfu {
+
+/**
+ * @brief Output device requirements for dfu::applier. New image is
+ * written sequentially, old image is read at absolute address, and
+ * already written part of new image is read back for CPY chunks.
+ * Optional fill(val, len) is used for REP chunks, see dfu::fillable.
+ * 
+ */
+template<class T>
+concept device = requires(T& dev, byte* dst, pointer src, size_t addr, size_t len) {
+    { dev.write(src, len) } -> std::same_as<err>;
+    { dev.read_old(addr, dst, len) } -> std::same_as<err>;
+    { dev.read_new(addr, dst, len) } -> std::same_as<err>;
+};
+
+/**
+ * @brief Device which can also reposition its output, needed to apply
+ * packets independently of each other.
+ * 
+ */
+template<class T>
+concept seekable = device<T> && requires(T& dev, size_t addr) {
+    { dev.seek(addr) } -> std::same_as<err>;
+};
+
+/**
+ * @brief Device which can write run of same byte on its own, e.g. to skip
+ * programming erased flash. Used by dfu::applier for REP chunks.
+ * 
+ */
+template<class T>
+concept fillable = device<T> && requires(T& dev, byte val, size_t len) {
+    { dev.fill(val, len) } -> std::same_as<err>;
+};
+
+/**
+ * @brief Device backed by plain memory. Old image is a read-only span,
+ * new image is written into user provided writable span.
+ * 
+ */
+struct memory {
+    constexpr memory(span old, std::span<byte> out) : old{old}, out{out} {}
+    constexpr err write(pointer src, size_t len)
+    {
+        if (len > out.size() - idx)
+            return err_no_memory;
+        std::copy_n(src, len, out.data() + idx);
+        idx += len;
+        return err_ok;
+    }
+    constexpr err read_old(size_t addr, byte* dst, size_t len) const
+    {
+        if (addr > old.size() || len > old.size() - addr)
+            return err_out_of_bounds;
+        std::copy_n(old.data() + addr, len, dst);
+        return err_ok;
+    }
+    constexpr err read_new(size_t addr, byte* dst, size_t len) const
+    {
+        if (addr > idx || len > idx - addr)
+            return err_out_of_bounds;
+        std::copy_n(out.data() + addr, len, dst);
+        return err_ok;
+    }
+    constexpr err seek(size_t addr)
+    {
+        if (addr > out.size())
+            return err_out_of_bounds;
+        idx = addr;
+        return err_ok;
+    }
+    constexpr size_t size() const   { return idx; }
+    constexpr span result() const   { return out.first(idx); }
+private:
+    span old;
+    std::span<byte> out;
+    size_t idx = 0;
+};
+
+/**
+ * @brief Applies decoded chunks to output device one by one. Keeps
+ * track of current output position, which OFF and CPY chunks are
+ * relative to. Uses small internal buffer for REP, OFF and CPY.
+ * 
+ * @tparam D Output device type, see dfu::device
+ * @tparam N Internal buffer size in bytes
+ */
+template<device D, size_t N = 256>
+struct applier {
+    constexpr applier(D& dev, size_t pos = 0) : dev{dev}, pos{pos} {}
+    constexpr size_t tell() const { return pos; }
+
+    /**
+     * @brief Apply single chunk.
+     * 
+     * @param cnk Decoded chunk
+     * @return Status from device or err_out_of_bounds for invalid reference
+     */
+    constexpr err apply(const chunk& cnk)
+    {
+        switch (cnk.type)
+        {
+        case type_raw: return raw(cnk.raw, cnk.size);
+        case type_rep: return rep(cnk.rep, cnk.size);
+        case type_arr: return arr(cnk.arr.data, cnk.size, cnk.arr.reps);
+        case type_off: return off(cnk.off, cnk.size);
+        case type_cpy: return cpy(cnk.cpy, cnk.size);
+        default: return err_invalid_size;
+        }
+    }
+
+    /**
+     * @brief Apply whole sequence. Unlike dfu::seq traversal, stops
+     * with error on truncated or invalid input.
+     * 
+     * @param s Encoded sequence
+     * @return First error encountered or err_ok
+     */
+    constexpr err apply(seq s)
+    {
+        return visit(s, 
+            [this](pointer data, size_t size)               { return raw(data, size); },
+            [this](byte val, size_t size)                   { return rep(val, size); },
+            [this](pointer data, size_t size, size_t reps)  { return arr(data, size, reps); },
+            [this](int32_t val, size_t size)                { return off(val, size); },
+            [this](uint32_t dist, size_t size)              { return cpy(dist, size); });
+    }
+private:
+    constexpr err raw(pointer data, size_t size)
+    {
+        return put(data, size);
+    }
+    constexpr err rep(byte val, size_t size)
+    {
+        if constexpr (fillable<D>) {
+            err e = dev.fill(val, size);
+            if (e == err_ok)
+                pos += size;
+            return e;
+        }
+        err e = err_ok;
+        std::fill_n(tmp, std::min(size, N), val);
+        for (size_t done = 0, len; e == err_ok && done < size; done += len) {
+            len = std::min(size - done, N);
+            e = put(tmp, len);
+        }
+        return e;
+    }
+    constexpr err arr(pointer data, size_t size, size_t reps)
+    {
+        err e = err_ok;
+        for (size_t i = 0; e == err_ok && i < reps; ++i)
+            e = put(data, size);
+        return e;
+    }
+    constexpr err off(int32_t val, size_t size)
+    {
+        if (val < 0 && size_t(-int64_t(val)) > pos)
+            return err_out_of_bounds;
+        err e = err_ok;
+        size_t addr = pos + val;
+        for (size_t done = 0, len; e == err_ok && done < size; done += len) {
+            len = std::min(size - done, N);
+            e = dev.read_old(addr + done, tmp, len);
+            if (e == err_ok)
+                e = put(tmp, len);
+        }
+        return e;
+    }
+    constexpr err cpy(size_t dist, size_t size)
+    {
+        if (!dist || dist > pos)
+            return err_out_of_bounds;
+        err e = err_ok;
+        for (size_t done = 0, len; e == err_ok && done < size; done += len) {
+            len = std::min({size - done, dist, N}); // NOTE: Overlapping copy goes period by period
+            e = dev.read_new(pos - dist, tmp, len);
+            if (e == err_ok)
+                e = put(tmp, len);
+        }
+        return e;
+    }
+    constexpr err put(pointer src, size_t len)
+    {
+        err e = dev.write(src, len);
+        if (e == err_ok)
+            pos += len;
+        return e;
+    }
+private:
+    D& dev;
+    size_t pos;
+    byte tmp[N]{};
+};
+
+/**
+ * @brief Apply whole encoded sequence to device, starting from zero
+ * output position.
+ * 
+ * @param s Encoded sequence
+ * @param dev Output device
+ * @return First error encountered or err_ok
+ */
+template<device D>
+constexpr err apply(seq s, D& dev)
+{
+    return applier<D>{dev}.apply(s);
+}
+
+}
+
+#endif
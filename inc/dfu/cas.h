@@ -0,0 +1,329 @@
+#ifndef DFU_CAS_H
+#define DFU_CAS_H
+
+#include "dfu/dif.h"
+#include "dfu/dig.h"
+#include <filesystem>
+#include <string>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace dfu {
+
+using cache_key = std::array<byte, sha256::length>;
+
+/**
+ * @brief Hit, miss and eviction counters of dfu::cache.
+ * 
+ */
+struct cache_stats {
+    size_t hits     = 0;
+    size_t misses   = 0;
+    size_t evicted  = 0;    // Entries removed to stay within size cap
+    size_t stale    = 0;    // Temporary files of dead writers removed
+};
+
+namespace cas {
+
+inline constexpr byte tag[] = {'d', 'f', 'u', '-', 'c', 'a', 's', '-', '1'};
+inline constexpr size_t name_len = 2 * sizeof(cache_key);
+
+inline std::string hex(const cache_key& key)
+{
+    static constexpr char digits[] = "0123456789abcdef";
+    std::string res;
+    for (auto it : key) {
+        res += digits[it >> 4];
+        res += digits[it & 15];
+    }
+    return res;
+}
+
+inline bool sync_dir(const std::filesystem::path& dir)
+{
+    int fd = ::open(dir.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd < 0)
+        return false;
+    bool ok = ::fsync(fd) == 0;
+    return ::close(fd) == 0 && ok;
+}
+
+inline bool write_all(int fd, span val)
+{
+    for (pointer p = val.data(), end = p + val.size(); p < end;) {
+        ssize_t n = ::write(fd, p, end - p);
+        if (n <= 0)
+            return false;
+        p += n;
+    }
+    return true;
+}
+
+}
+
+/**
+ * @brief Cache key: digest of old image digest, new image digest and every
+ * differ parameter, so any change of inputs addresses different entry.
+ * 
+ */
+inline cache_key cache_key_of(span old_img, span new_img, const diff_params& prm)
+{
+    sha256 old_dig, new_dig, key;
+    old_dig.update(old_img);
+    new_dig.update(new_img);
+
+    key.update(cas::tag);
+    key.update(old_dig.value());
+    key.update(new_dig.value());
+    for (uint32_t it : {prm.max_chain, prm.min_match, prm.min_rep, uint32_t(prm.bits), uint32_t(prm.self), uint32_t(prm.erased)}) {
+        const byte le[4] = {byte(it), byte(it >> 8), byte(it >> 16), byte(it >> 24)};
+        key.update(le);
+    }
+    return key.value();
+}
+
+/**
+ * @brief Read-only memory mapping of cached patch, unmapped on destruction.
+ * Stays valid even if entry is evicted meanwhile.
+ * 
+ */
+struct mapping {
+    mapping() = default;
+    mapping(const mapping&) = delete;
+    mapping(mapping&& other) noexcept { *this = std::move(other); }
+    mapping& operator=(mapping&& other) noexcept
+    {
+        std::swap(ptr, other.ptr);
+        std::swap(len, other.len);
+        std::swap(ok, other.ok);
+        return *this;
+    }
+    ~mapping()
+    {
+        if (ptr)
+            ::munmap(const_cast<byte*>(ptr), len);
+    }
+    explicit operator bool() const  { return ok; }
+    seq body(extension ext = ext_none) const { return {ptr, len, ext}; }
+
+    /**
+     * @brief Map whole file, empty file is valid empty patch.
+     * 
+     */
+    static mapping open(const std::filesystem::path& path)
+    {
+        mapping res;
+        int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0)
+            return res;
+        struct stat st;
+        if (::fstat(fd, &st) == 0) {
+            res.len = st.st_size;
+            if (!res.len) {
+                res.ok = true;
+            } else if (void* p = ::mmap(nullptr, res.len, PROT_READ, MAP_SHARED, fd, 0); p != MAP_FAILED) {
+                res.ptr = static_cast<pointer>(p);
+                res.ok = true;
+            }
+        }
+        ::close(fd);
+        return res;
+    }
+private:
+    pointer ptr = nullptr;
+    size_t len  = 0;
+    bool ok     = false;
+};
+
+/**
+ * @brief Content-addressed on-disk cache of patches, shared by concurrent
+ * processes through a plain directory. Entry is published atomically by
+ * rename() of fully written and synced temporary file, so readers see
+ * either nothing or complete patch, and directory is synced afterwards,
+ * so published entry survives power loss. Lookup maps the file and bumps
+ * its modification time, which serves as LRU order when total size
+ * exceeds the cap and oldest entries get removed. Temporary files older
+ * than grace period are left by writers which died before publishing and
+ * are removed on eviction as well.
+ * 
+ */
+struct cache {
+    static constexpr std::chrono::minutes grace{10};
+
+    cache(std::filesystem::path dir, uint64_t cap) : dir{std::move(dir)}, cap{cap}
+    {
+        std::error_code ec;
+        std::filesystem::create_directories(this->dir, ec);
+    }
+    const cache_stats& stats() const    { return cnt; }
+    std::filesystem::path path(const cache_key& key) const { return dir / cas::hex(key); }
+
+    /**
+     * @brief Look up entry and mark it as recently used.
+     * 
+     * @return Mapping, empty on miss
+     */
+    mapping find(const cache_key& key)
+    {
+        auto res = mapping::open(path(key));
+        if (res) {
+            std::error_code ec;
+            std::filesystem::last_write_time(path(key), std::filesystem::file_time_type::clock::now(), ec);
+            ++cnt.hits;
+        } else {
+            ++cnt.misses;
+        }
+        return res;
+    }
+
+    /**
+     * @brief Publish entry atomically, then evict least recently used
+     * entries, except this one, till total size fits the cap.
+     * 
+     * @return err_no_memory if entry couldn't be written or synced, otherwise err_ok
+     */
+    err store(const cache_key& key, span patch)
+    {
+        const auto tmp = dir / (cas::hex(key) + ".tmp." + std::to_string(::getpid()) + "." + std::to_string(seqno++));
+
+        int fd = ::open(tmp.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+        if (fd < 0)
+            return err_no_memory;
+        bool ok = cas::write_all(fd, patch) && ::fsync(fd) == 0;
+        ok = ::close(fd) == 0 && ok;
+
+        std::error_code ec;
+        if (ok)
+            std::filesystem::rename(tmp, path(key), ec);
+        if (!ok || ec) {
+            std::filesystem::remove(tmp, ec);
+            return err_no_memory;
+        }
+        ok = cas::sync_dir(dir);
+        evict(&key);
+        return ok ? err_ok : err_no_memory;
+    }
+
+    /**
+     * @brief Get patch from cache, or run differ and publish its result.
+     * 
+     * @param old_img Old image
+     * @param new_img New image
+     * @param out Mapping of patch, body needs dfu::ext_cpy if prm.self is set
+     * @param prm Differ parameters, part of the key
+     * @return Differ or store error, otherwise err_ok
+     */
+    err get(span old_img, span new_img, mapping& out, const diff_params& prm = {})
+    {
+        const auto key = cache_key_of(old_img, new_img, prm);
+
+        if ((out = find(key)))
+            return err_ok;
+
+        std::vector<byte> buf(new_img.size() + new_img.size() / 8 + 64);
+        size_t len = 0;
+        err e;
+        while ((e = diff(old_img, new_img, ref{buf, len}, prm)) == err_no_memory) {
+            buf.resize(buf.size() * 2);
+            len = 0;
+        }
+        if (e != err_ok)
+            return e;
+        if ((e = store(key, {buf.data(), len})) != err_ok)
+            return e;
+
+        out = mapping::open(path(key));
+        return out ? err_ok : err_no_memory; // NOTE: Only if other process evicted it right away
+    }
+
+    /**
+     * @brief Total size of all entries in bytes.
+     * 
+     */
+    uint64_t usage() const
+    {
+        uint64_t total = 0;
+        for (auto& it : entries())
+            total += it.size;
+        return total;
+    }
+
+    /**
+     * @brief Remove stale temporary files, then least recently used entries
+     * till total size fits the cap.
+     * 
+     * @param keep Optional entry which is never removed
+     */
+    void evict(const cache_key* keep = nullptr)
+    {
+        sweep();
+
+        auto all = entries();
+        uint64_t total = 0;
+        for (auto& it : all)
+            total += it.size;
+        if (total <= cap)
+            return;
+
+        std::sort(all.begin(), all.end(), [](auto& a, auto& b) { return a.time < b.time; });
+
+        const auto kept = keep ? path(*keep) : std::filesystem::path{};
+        std::error_code ec;
+        for (auto& it : all) {
+            if (total <= cap)
+                break;
+            if (it.path == kept)
+                continue;
+            if (std::filesystem::remove(it.path, ec))
+                ++cnt.evicted;
+            total -= it.size;
+        }
+    }
+private:
+    struct entry {
+        std::filesystem::path path;
+        std::filesystem::file_time_type time;
+        uint64_t size;
+    };
+    void sweep()
+    {
+        std::vector<std::filesystem::path> stale;
+        std::error_code ec;
+        const auto limit = std::filesystem::file_time_type::clock::now() - grace;
+        for (auto& it : std::filesystem::directory_iterator{dir, ec}) {
+            if (it.path().filename().native().find(".tmp.") != cas::name_len) // NOTE: Only own temporary files, see store()
+                continue;
+            auto time = it.last_write_time(ec);
+            if (!ec && time < limit)
+                stale.push_back(it.path());
+        }
+        for (auto& it : stale)
+            if (std::filesystem::remove(it, ec))
+                ++cnt.stale;
+    }
+    std::vector<entry> entries() const
+    {
+        std::vector<entry> res;
+        std::error_code ec;
+        for (auto& it : std::filesystem::directory_iterator{dir, ec}) {
+            if (it.path().filename().native().size() != cas::name_len || !it.is_regular_file(ec)) // NOTE: Skips temporary files of pending publishes
+                continue;
+            auto time = it.last_write_time(ec);
+            auto size = it.file_size(ec);
+            if (!ec)
+                res.push_back({it.path(), time, size});
+        }
+        return res;
+    }
+private:
+    std::filesystem::path dir;
+    uint64_t cap;
+    uint64_t seqno = 0;
+    cache_stats cnt;
+};
+
+}
+
+#endif
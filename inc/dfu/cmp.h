@@ -0,0 +1,272 @@
+#ifndef DFU_CMP_H
+#define DFU_CMP_H
+
+#include "dfu/enc.h"
+#include <vector>
+
+namespace dfu {
+
+/**
+ * @brief Encoder front-end which coalesces adjacent pieces of same kind
+ * before encoding: RAW pieces are concatenated, REP of same byte, OFF of
+ * same offset and CPY of same distance are extended. Useful when output
+ * is produced in fragments, so every fragment doesn't cost its own header.
+ * Pending piece is encoded only on explicit flush().
+ * 
+ */
+struct merger {
+    merger(ref out) : out{out} {}
+
+    err raw(span val)
+    {
+        if (kind != type_raw)
+            flush();
+        kind = type_raw;
+        buf.insert(buf.end(), val.begin(), val.end());
+        return e;
+    }
+    err rep(byte val, size_t len)
+    {
+        if (kind != type_rep || arg != val)
+            flush();
+        return extend(type_rep, val, len);
+    }
+    err arr(span val, size_t reps)
+    {
+        flush();
+        if (e == err_ok)
+            e = out.encode_arr(val, reps);
+        return e;
+    }
+    err off(int32_t val, size_t len)
+    {
+        if (kind != type_off || arg != val)
+            flush();
+        return extend(type_off, val, len);
+    }
+    err cpy(size_t val, size_t len)
+    {
+        if (kind != type_cpy || arg != int64_t(val))
+            flush();
+        return extend(type_cpy, val, len);
+    }
+    err put(const chunk& cnk)
+    {
+        switch (cnk.type)
+        {
+        case type_raw: return raw({cnk.raw, cnk.size});
+        case type_rep: return rep(cnk.rep, cnk.size);
+        case type_arr: return arr({cnk.arr.data, cnk.size}, cnk.arr.reps);
+        case type_off: return off(cnk.off, cnk.size);
+        case type_cpy: return cpy(cnk.cpy, cnk.size);
+        default: return e = err_invalid_size;
+        }
+    }
+    err flush()
+    {
+        for (size_t done = 0, n; e == err_ok && done < cnt; done += n) {
+            n = std::min(cnt - done, max_size);
+            switch (kind)
+            {
+            case type_rep: e = out.encode_rep(byte(arg), n); break;
+            case type_off: e = out.encode_off(int32_t(arg), n); break;
+            case type_cpy: e = out.encode_cpy(arg, n); break;
+            default:;
+            }
+        }
+        for (size_t done = 0, n; e == err_ok && done < buf.size(); done += n) {
+            n = std::min(buf.size() - done, max_size);
+            e = out.encode_raw(span{buf}.subspan(done, n));
+        }
+        buf.clear();
+        cnt  = 0;
+        kind = type_invalid;
+        return e;
+    }
+    err status() const { return e; }
+private:
+    err extend(chunk_type t, int64_t val, size_t len)
+    {
+        kind = t;
+        arg  = val;
+        cnt += len;
+        return e;
+    }
+private:
+    static constexpr size_t max_size = 0x10000000;
+    ref out;
+    std::vector<byte> buf;
+    chunk_type kind = type_invalid;
+    int64_t arg = 0;
+    size_t cnt = 0;
+    err e = err_ok;
+};
+
+namespace cmp {
+
+/**
+ * @brief Output extents of a patch, i.e. which chunk produced which
+ * range of its output image.
+ * 
+ */
+struct extents {
+    err load(seq s)
+    {
+        size_t pos = 0;
+        for (pointer p = s.data(), end = p + s.size(); p < end;) {
+            auto [cnk, e, next] = decode(p, end, s.ext);
+            if (e != err_ok)
+                return e;
+            starts.push_back(pos);
+            chunks.push_back(cnk);
+            pos += cnk.type == type_arr ? cnk.size * cnk.arr.reps : cnk.size;
+            p = next;
+        }
+        starts.push_back(pos);
+        return err_ok;
+    }
+    size_t find(size_t addr) const
+    {
+        return std::upper_bound(starts.begin(), starts.end(), addr) - starts.begin() - 1;
+    }
+    size_t total() const { return starts.back(); }
+
+    std::vector<size_t> starts;
+    std::vector<chunk> chunks;
+};
+
+/**
+ * @brief Emit pieces producing intermediate image range [addr, addr + len)
+ * as written at output position pos, resolving references of producing
+ * patch down to its own old image. Pieces landing in CPY are replaced by
+ * their source in the period before that chunk and resolved in turn, so
+ * chains of CPY go through work list instead of call stack.
+ * 
+ */
+inline err resolve(const extents& ext, merger& mrg, size_t addr, size_t len, size_t pos)
+{
+    struct piece {
+        size_t addr;
+        size_t len;
+        size_t pos;
+        size_t dist;    // NOTE: Non-zero means periodic tail, emitted as CPY as is
+    };
+    std::vector<piece> todo = {{addr, len, pos, 0}};
+    err e = err_ok;
+
+    while (e == err_ok && !todo.empty()) {
+
+        auto [addr, len, pos, dist] = todo.back();
+        todo.pop_back();
+
+        if (dist) {
+            e = mrg.cpy(dist, len);
+            continue;
+        }
+        if (addr > ext.total() || len > ext.total() - addr)
+            return err_out_of_bounds;
+
+        for (size_t i = ext.find(addr), n; e == err_ok && len; ++i, addr += n, pos += n, len -= n) {
+
+            const chunk& cnk = ext.chunks[i];
+            const size_t k = addr - ext.starts[i];
+            n = std::min(len, ext.starts[i + 1] - addr);
+
+            switch (cnk.type)
+            {
+            case type_raw:
+                e = mrg.raw({cnk.raw + k, n});
+            break;
+            case type_rep:
+                e = mrg.rep(cnk.rep, n);
+            break;
+            case type_arr: {
+                const size_t head = k % cnk.size;
+                size_t left = n;
+                if (head) {
+                    size_t m = std::min(cnk.size - head, left);
+                    e = mrg.raw({cnk.arr.data + head, m});
+                    left -= m;
+                }
+                if (e == err_ok && left >= cnk.size)
+                    e = mrg.arr({cnk.arr.data, cnk.size}, left / cnk.size);
+                if (e == err_ok && left % cnk.size)
+                    e = mrg.raw({cnk.arr.data, left % cnk.size});
+            }
+            break;
+            case type_off: {
+                int64_t off = int64_t(addr) + cnk.off - int64_t(pos);
+                if (offset_width(off) > 3)
+                    return err_invalid_size;
+                e = mrg.off(off, n);
+            }
+            break;
+            case type_cpy: {
+                const size_t d = cnk.cpy;
+                if (d > ext.starts[i])
+                    return err_out_of_bounds;
+                const size_t src = ext.starts[i] - d;
+                const size_t first = std::min<size_t>(n, d);
+                const size_t head = std::min(first, d - k % d);
+                // NOTE: Pushed in reverse, so pieces come out in output order and rest of range after them
+                if (len > n)
+                    todo.push_back({addr + n, len - n, pos + n, 0});
+                if (n > first)
+                    todo.push_back({0, n - first, pos + first, d}); // NOTE: Rest is periodic in output as well
+                if (first > head)
+                    todo.push_back({src, first - head, pos + head, 0});
+                todo.push_back({src + k % d, head, pos, 0});
+                len = n; // NOTE: Ends this range, rest of it is on work list
+            }
+            break;
+            default:
+                return err_invalid_size;
+            }
+        }
+    }
+    return e;
+}
+
+}
+
+/**
+ * @brief Compose patches A->B and B->C into A->C without materializing
+ * any of images. OFF chunks of second patch are resolved through output
+ * extents of first one, data chunks are kept as is where needed, and
+ * adjacent pieces are coalesced. Output contains CPY only if any of
+ * inputs is read with dfu::ext_cpy, and needs it as well then.
+ * 
+ * @param ab Patch from A to B
+ * @param bc Patch from B to C
+ * @param out Output codec for patch from A to C
+ * @return First error encountered or err_ok
+ */
+inline err compose(seq ab, seq bc, ref out)
+{
+    cmp::extents ext;
+    err e = ext.load(ab);
+    merger mrg{out};
+    size_t pos = 0;
+
+    for (pointer p = bc.data(), end = p + bc.size(); e == err_ok && p < end;) {
+        auto [cnk, de, next] = decode(p, end, bc.ext);
+        if (de != err_ok)
+            return de;
+        if (cnk.type == type_off) {
+            if (cnk.off < 0 && size_t(-int64_t(cnk.off)) > pos)
+                return err_out_of_bounds;
+            e = cmp::resolve(ext, mrg, pos + cnk.off, cnk.size, pos);
+        } else {
+            e = mrg.put(cnk);
+        }
+        pos += cnk.type == type_arr ? cnk.size * cnk.arr.reps : cnk.size;
+        p = next;
+    }
+    if (e == err_ok)
+        e = mrg.flush();
+    return e;
+}
+
+}
+
+#endif
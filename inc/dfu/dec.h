@@ -5,6 +5,7 @@
 #include <cstddef>
 #include <span>
 #include <tuple>
+#include <type_traits>
 
 namespace dfu {
 
@@ -22,10 +23,12 @@ enum err {
     err_out_of_bounds,
     err_no_memory,
     err_invalid_size,
+    err_mismatch,
 };
 
 /**
- * @brief Chunk type, 2 bits in header.
+ * @brief Chunk type, 2 bits in header. Extension types don't have 
+ * their own header code and are derived from encoding of a base type.
  * 
  */
 enum chunk_type {
@@ -33,9 +36,21 @@ enum chunk_type {
     type_rep,
     type_arr,
     type_off,
+    type_cpy, // NOTE: Extension, OFF with non-canonical offset width, only with dfu::ext_cpy
     type_invalid,
 };
 
+/**
+ * @brief Decoder extensions. Each one gives new meaning to encodings which
+ * base decoder accepts as something else, so it must be enabled explicitly,
+ * e.g. from container flags, and never guessed from the stream itself.
+ * 
+ */
+enum extension {
+    ext_none,
+    ext_cpy, // NOTE: Padded OFF is CPY, legacy producers may pad OFF too
+};
+
 /**
  * @brief Chunk data for repeated sections.
  * 
@@ -59,66 +74,152 @@ struct chunk {
         byte rep;
         array arr;
         int32_t off;
+        uint32_t cpy;
     };
 };
 
 /**
- * @brief Decode next adjacent chunk in a given range. Includes bounds checks.
+ * @brief Get minimal number of extra bytes (besides first) needed to 
+ * encode signed offset of OFF chunk. Values which don't fit return 4.
  * 
- * @param p Begin pointer, must be valid
- * @param end End pointer, must be valid
- * @return Tuple with decoded chunk, err status and pointer past last byte interpreted
+ * @param val Signed offset
+ * @return Number of extra bytes 
  */
-constexpr std::tuple<chunk, err, pointer> decode(pointer p, const pointer end)
+constexpr int offset_width(int64_t val)
+{
+    for (int ai = 0; ai < 4; ++ai)
+        if (val >= -(int64_t(1) << (ai * 8 + 5)) && val < (int64_t(1) << (ai * 8 + 5)))
+            return ai;
+    return 4;
+}
+
+namespace dec {
+
+/**
+ * @brief Call handler and convert its result to err, handlers may return 
+ * either err or nothing.
+ * 
+ */
+template<class F, class... Args>
+constexpr err call(F& f, Args... args)
+{
+    if constexpr (std::is_void_v<std::invoke_result_t<F&, Args...>>) {
+        f(args...);
+        return err_ok;
+    } else {
+        return f(args...);
+    }
+}
+
+/**
+ * @brief Decode next adjacent chunk and pass its fields straight to 
+ * type-specific handler. Core of both dfu::decode() and dfu::visit().
+ * 
+ * @return Tuple with err status, either decoding or from handler, and 
+ * pointer past last byte interpreted
+ */
+template<class Raw, class Rep, class Arr, class Off, class Cpy>
+constexpr std::tuple<err, pointer> step(pointer p, const pointer end, extension ext, Raw& on_raw, Rep& on_rep, Arr& on_arr, Off& on_off, Cpy& on_cpy)
 {
     if (p >= end)
-        return {{}, err_out_of_bounds, end};
+        return {err_out_of_bounds, end};
 
-    chunk cnk = chunk_type(*p & 0b0000'0011);
+    auto type = chunk_type(*p & 0b0000'0011);
     auto extr =           (*p & 0b0000'1100) >> 2;
     auto size =           (*p & 0b1111'0000) >> 4;
 
     if (++p + extr >= end)
-        return {{}, err_out_of_bounds, p};
+        return {err_out_of_bounds, p};
 
     for (int i = 4; i < extr * 8 + 4; i += 8)
         size |= int(*p++) << i;
     
-    cnk.size = ++size;
+    const size_t len = ++size;
 
-    switch (cnk.type) 
+    switch (type) 
     {
     case type_raw:
         if (p + size > end)
-            return {{}, err_out_of_bounds, p};
-        cnk.raw = p;
+            return {err_out_of_bounds, p};
         p += size;
-    break;
+        return {call(on_raw, p - size, len), p};
     case type_rep:
         if (p >= end)
-            return {{}, err_out_of_bounds, p};
-        cnk.rep = *p++;
-    break;
-    case type_arr:
+            return {err_out_of_bounds, p};
+        ++p;
+        return {call(on_rep, p[-1], len), p};
+    case type_arr: {
         if (p + size >= end) // NOTE: >= because + 1 byte for reps
-            return {{}, err_out_of_bounds, p};
-        cnk.arr.reps = *p++ + 1;
-        cnk.arr.data = p;
+            return {err_out_of_bounds, p};
+        size_t reps = *p++ + 1;
         p += size;
-    break;
-    case type_off:
+        return {call(on_arr, p - size, len, reps), p};
+    }
+    case type_off: {
         extr    =  *p & 0b0000'0011;
-        cnk.off = (*p & 0b1111'1100) >> 2;
+        int32_t off = (*p & 0b1111'1100) >> 2;
         if (++p + extr > end)
-            return {{}, err_out_of_bounds, p};
+            return {err_out_of_bounds, p};
         for (int i = 6; i < extr * 8 + 6; i += 8)
-            cnk.off |= int(*p++) << i;
-        if (cnk.off >> (extr * 8 + 5))
-            cnk.off -= 1 << (extr * 8 + 6);
-    break;
-    default:;
+            off |= int(*p++) << i;
+        if (off >> (extr * 8 + 5))
+            off -= 1 << (extr * 8 + 6);
+        if (ext == ext_cpy && extr && offset_width(off) < extr) { // NOTE: Canonical OFF never uses wider offset than needed
+            if (off <= 0)
+                return {err_invalid_size, p};
+            return {call(on_cpy, uint32_t(off), len), p};
+        }
+        return {call(on_off, off, len), p};
     }
-    return {cnk, err_ok, p};
+    default:
+        return {err_invalid_size, p};
+    }
+}
+
+}
+
+/**
+ * @brief Decode next adjacent chunk in a given range. Includes bounds checks.
+ * 
+ * @param p Begin pointer, must be valid
+ * @param end End pointer, must be valid
+ * @param ext Enabled extension, by default padded OFF is just OFF
+ * @return Tuple with decoded chunk, err status and pointer past last byte interpreted
+ */
+constexpr std::tuple<chunk, err, pointer> decode(pointer p, const pointer end, extension ext = ext_none)
+{
+    chunk cnk;
+
+    auto on_raw = [&](pointer data, size_t size) { 
+        cnk = type_raw; 
+        cnk.size = size; 
+        cnk.raw = data; 
+    };
+    auto on_rep = [&](byte val, size_t size) { 
+        cnk = type_rep; 
+        cnk.size = size; 
+        cnk.rep = val; 
+    };
+    auto on_arr = [&](pointer data, size_t size, size_t reps) { 
+        cnk = type_arr; 
+        cnk.size = size; 
+        cnk.arr = {reps, data}; 
+    };
+    auto on_off = [&](int32_t off, size_t size) { 
+        cnk = type_off; 
+        cnk.size = size; 
+        cnk.off = off; 
+    };
+    auto on_cpy = [&](uint32_t dist, size_t size) { 
+        cnk = type_cpy; 
+        cnk.size = size; 
+        cnk.cpy = dist; 
+    };
+    auto [e, next] = dec::step(p, end, ext, on_raw, on_rep, on_arr, on_off, on_cpy);
+
+    if (e != err_ok)
+        return {{}, e, next};
+    return {cnk, err_ok, next};
 }
 
 /**
@@ -128,7 +229,7 @@ constexpr std::tuple<chunk, err, pointer> decode(pointer p, const pointer end)
  */
 struct seq_iter {
     constexpr seq_iter() = default;
-    constexpr seq_iter(pointer head, pointer tail) : head{head}, tail{tail}
+    constexpr seq_iter(pointer head, pointer tail, extension ext = ext_none) : head{head}, tail{tail}, ext{ext}
     {
         step(val);
     }
@@ -148,24 +249,72 @@ struct seq_iter {
 private:
     constexpr void step(chunk& o) 
     {
-        std::tie(o, std::ignore, head) = decode(head, tail); 
+        std::tie(o, std::ignore, head) = decode(head, tail, ext); 
     }
 private:
     pointer head = nullptr;
     pointer tail = nullptr;
+    extension ext = ext_none;
     chunk val;
 };
 
 /**
  * @brief Read-only span wrapper for traversal on-the-fly using dfu::seq_iter.
+ * Carries decoder extension, which every consumer of sequence applies.
  * 
  */
 struct seq : span {
     using span::span;
-    constexpr seq_iter begin() const    { return {data(), data() + size()}; }
+    constexpr seq(pointer p, size_t n, extension ext) : span{p, n}, ext{ext} {}
+    constexpr seq_iter begin() const    { return {data(), data() + size(), ext}; }
     constexpr seq_iter end() const      { return {}; }
+    extension ext = ext_none;
 };
 
+/**
+ * @brief Walk whole sequence, calling type-specific handler for each chunk 
+ * directly from decoder switch, without materializing dfu::chunk and 
+ * switching on its type again. Handlers may return err to stop early.
+ * 
+ * @param s Encoded sequence
+ * @param on_raw Called with (pointer data, size_t size)
+ * @param on_rep Called with (byte val, size_t size)
+ * @param on_arr Called with (pointer data, size_t size, size_t reps)
+ * @param on_off Called with (int32_t off, size_t size)
+ * @param on_cpy Called with (uint32_t dist, size_t size)
+ * @return First decoding or handler error, or err_ok
+ */
+template<class Raw, class Rep, class Arr, class Off, class Cpy>
+constexpr err visit(seq s, Raw&& on_raw, Rep&& on_rep, Arr&& on_arr, Off&& on_off, Cpy&& on_cpy)
+{
+    for (pointer p = s.data(), end = p + s.size(); p < end;) {
+        err e;
+        std::tie(e, p) = dec::step(p, end, s.ext, on_raw, on_rep, on_arr, on_off, on_cpy);
+        if (e != err_ok)
+            return e;
+    }
+    return err_ok;
+}
+
+/**
+ * @brief Check that whole range is well-formed sequence, i.e. every chunk 
+ * decodes and last one ends exactly at the end. Usable at compile time 
+ * to reject malformed patch tables with static_assert.
+ * 
+ * @param s Encoded sequence
+ * @return First decoding error or err_ok
+ */
+constexpr err validate(seq s)
+{
+    for (pointer p = s.data(), end = p + s.size(); p < end;) {
+        err e;
+        std::tie(std::ignore, e, p) = decode(p, end, s.ext);
+        if (e != err_ok)
+            return e;
+    }
+    return err_ok;
+}
+
 }
 
 #endif
\ No newline at end of file
@@ -0,0 +1,296 @@
+#ifndef DFU_DIF_H
+#define DFU_DIF_H
+
+#include "dfu/enc.h"
+#include <chrono>
+#include <vector>
+
+namespace dfu {
+
+/**
+ * @brief Differ tuning parameters.
+ * 
+ */
+struct diff_params {
+    uint32_t max_chain  = 32;   // Candidates checked per lookup in each source
+    uint32_t min_match  = 4;    // Shortest OFF or CPY considered, at least 4
+    uint32_t min_rep    = 4;    // Shortest REP considered
+    int      bits       = 16;   // Log2 of index bucket count
+    bool     self       = false; // Allow CPY from already written new image, output then needs dfu::ext_cpy
+    int      erased     = -1;   // Erased flash value, its REP wins over any match, -1 disables
+};
+
+/**
+ * @brief Shared work and memory of dfu::diff_batch() run.
+ * 
+ */
+struct batch_stats {
+    size_t corpus = 0;                  // Bytes of shared corpus, all bases and new image
+    size_t memory = 0;                  // Bytes of shared index
+    std::chrono::nanoseconds build{};   // Time spent building shared index, once
+    std::chrono::nanoseconds match{};   // Time spent in per base passes, total
+};
+
+/**
+ * @brief Match index over a corpus. Positions are bucketed by hash of
+ * 4 bytes and sorted within a bucket, so candidates from any region of
+ * corpus (old image, new image or anything concatenated) are found with
+ * binary search. Built once and can be shared between diff passes.
+ * 
+ */
+struct index {
+    index(span corpus, int bits = 16) : data{corpus}, bits{bits}
+    {
+        const size_t n = data.size() >= 4 ? data.size() - 3 : 0;
+
+        head.assign((size_t(1) << bits) + 1, 0);
+        for (size_t i = 0; i < n; ++i)
+            ++head[hash(i) + 1];
+        for (size_t i = 1; i < head.size(); ++i)
+            head[i] += head[i - 1];
+
+        std::vector<uint32_t> fill(head.begin(), head.end() - 1);
+        pos.resize(n);
+        for (size_t i = 0; i < n; ++i)
+            pos[fill[hash(i)]++] = i;
+    }
+    uint32_t hash(size_t i) const
+    {
+        uint32_t v =    uint32_t(data[i]) |
+                        uint32_t(data[i + 1]) << 8 |
+                        uint32_t(data[i + 2]) << 16 |
+                        uint32_t(data[i + 3]) << 24;
+        return (v * 2654435761u) >> (32 - bits);
+    }
+    std::span<const uint32_t> find(uint32_t h, size_t lo, size_t hi) const
+    {
+        auto b = pos.begin() + head[h];
+        auto e = pos.begin() + head[h + 1];
+        b = std::lower_bound(b, e, lo);
+        e = std::lower_bound(b, e, hi);
+        return {b, e};
+    }
+    size_t memory() const
+    {
+        return (head.size() + pos.size()) * sizeof(uint32_t);
+    }
+    span data;
+private:
+    int bits;
+    std::vector<uint32_t> head;
+    std::vector<uint32_t> pos;
+};
+
+namespace dif {
+
+inline constexpr size_t max_size = 0x10000000;
+inline constexpr size_t max_dist = 0x1fffff;
+
+/**
+ * @brief Greedy differ pass over index corpus. New image is region
+ * [new_lo, new_hi), which is matched against old image region
+ * [old_lo, old_hi) with OFF and against itself with CPY.
+ * 
+ */
+inline err run(const index& idx, size_t old_lo, size_t old_hi, size_t new_lo, size_t new_hi, ref out, const diff_params& prm)
+{
+    const pointer c = idx.data.data();
+    const size_t min_match = std::max<size_t>(prm.min_match, 4);
+
+    size_t lit = new_lo;
+    int64_t last = 0;
+    err e = err_ok;
+
+    auto extend = [&](size_t a, size_t b, size_t limit) {
+        size_t len = 0;
+        limit = std::min(limit, max_size);
+        while (len < limit && c[a + len] == c[b + len])
+            ++len;
+        return len;
+    };
+    auto flush = [&](size_t end) {
+        for (size_t len; e == err_ok && lit < end; lit += len) {
+            len = std::min(end - lit, max_size);
+            e = out.encode_raw(span{c + lit, len});
+        }
+    };
+
+    for (size_t i = new_lo; e == err_ok && i < new_hi;) {
+
+        const size_t rem = new_hi - i;
+
+        chunk_type type = type_invalid;
+        size_t len = 0;
+        int64_t arg = 0;
+        int64_t gain = lit < i; // NOTE: Splitting pending RAW costs another header
+
+        auto consider = [&](chunk_type t, size_t l, int64_t a, size_t cost) {
+            if (int64_t(l) - int64_t(cost) > gain) {
+                gain = l - cost;
+                type = t;
+                len  = l;
+                arg  = a;
+            }
+        };
+        auto consider_off = [&](size_t cand) {
+            auto l = extend(cand, i, std::min(rem, old_hi - cand));
+            auto o = int64_t(cand - old_lo) - int64_t(i - new_lo);
+            if (l >= min_match && offset_width(o) < 4)
+                consider(type_off, l, o, enc::head_len(l) + offset_width(o) + 1);
+        };
+
+        size_t run = 1;
+        while (run < rem && run < max_size && c[i + run] == c[i])
+            ++run;
+        if (run >= prm.min_rep)
+            consider(type_rep, run, c[i], enc::head_len(run) + 1);
+
+        const bool erased = run >= prm.min_rep && c[i] == prm.erased; // NOTE: Lets flash writer skip it instead of programming copy
+        if (erased) {
+            type = type_rep;
+            len  = run;
+            arg  = c[i];
+        }
+        int64_t expect = int64_t(i - new_lo) + last + int64_t(old_lo);
+
+        if (!erased && expect >= int64_t(old_lo) && expect < int64_t(old_hi))
+            consider_off(expect);
+
+        if (!erased && rem >= 4) {
+            const auto h = idx.hash(i);
+            const auto old_cands = idx.find(h, old_lo, std::max(old_hi, old_lo + 3) - 3); // NOTE: Hash of last 3 bytes covers whatever follows in corpus
+            auto r = std::lower_bound(old_cands.begin(), old_cands.end(), uint64_t(std::max<int64_t>(expect, 0)));
+            auto l = r;
+
+            for (uint32_t n = 0; n < prm.max_chain && (l != old_cands.begin() || r != old_cands.end()); ++n) {
+                if (r != old_cands.end() && (l == old_cands.begin() || n & 1))
+                    consider_off(*r++);
+                else
+                    consider_off(*--l);
+            }
+            if (prm.self) {
+                const auto new_cands = idx.find(h, new_lo, i);
+                auto it = new_cands.end();
+                for (uint32_t n = 0; n < prm.max_chain && it != new_cands.begin(); ++n) {
+                    size_t cand = *--it;
+                    size_t dist = i - cand;
+                    if (dist > max_dist)
+                        break;
+                    auto l = extend(cand, i, rem);
+                    if (l >= min_match)
+                        consider(type_cpy, l, dist, enc::head_len(l) + offset_width(dist) + 2);
+                }
+            }
+        }
+
+        if (type == type_invalid) {
+            ++i;
+            continue;
+        }
+        flush(i);
+        if (e != err_ok)
+            break;
+        switch (type)
+        {
+        case type_rep:
+            e = out.encode_rep(byte(arg), len);
+        break;
+        case type_off:
+            e = out.encode_off(int32_t(arg), len);
+            last = arg;
+        break;
+        case type_cpy:
+            e = out.encode_cpy(size_t(arg), len);
+        break;
+        default:;
+        }
+        i += len;
+        lit = i;
+    }
+    flush(new_hi);
+
+    return e;
+}
+
+}
+
+/**
+ * @brief Produce encoded sequence which transforms old image into new
+ * one. Matches are searched both in old image (OFF) and in part of new
+ * image already written (CPY), runs of same byte are encoded as REP.
+ * 
+ * @param old_img Old image
+ * @param new_img New image
+ * @param out Output codec
+ * @param prm Differ parameters
+ * @return err_no_memory if output doesn't fit, otherwise err_ok
+ */
+inline err diff(span old_img, span new_img, ref out, const diff_params& prm = {})
+{
+    std::vector<byte> corpus(old_img.size() + new_img.size());
+    std::copy(old_img.begin(), old_img.end(), corpus.begin());
+    std::copy(new_img.begin(), new_img.end(), corpus.begin() + old_img.size());
+
+    const index idx{corpus, prm.bits};
+
+    return dif::run(idx, 0, old_img.size(), old_img.size(), corpus.size(), out, prm);
+}
+
+/**
+ * @brief Produce patches from many old images (bases) to one new image.
+ * All bases and new image are concatenated into single corpus and match
+ * index is built only once, then each base is diffed against its own 
+ * region of it. Output is identical to calling dfu::diff() per base.
+ * 
+ * @param bases Old images
+ * @param new_img New image
+ * @param outs Output codecs, one per base
+ * @param prm Differ parameters
+ * @param stats Optional shared work and memory report
+ * @return First error encountered or err_ok
+ */
+inline err diff_batch(std::span<const span> bases, span new_img, std::span<ref> outs, const diff_params& prm = {}, batch_stats* stats = nullptr)
+{
+    if (outs.size() != bases.size())
+        return err_invalid_size;
+
+    using clock = std::chrono::steady_clock;
+
+    size_t total = new_img.size();
+    for (auto it : bases)
+        total += it.size();
+    if (total > UINT32_MAX)
+        return err_invalid_size;
+
+    auto t0 = clock::now();
+
+    std::vector<byte> corpus(total);
+    std::vector<size_t> lo(bases.size() + 1);
+    auto it = corpus.begin();
+    for (size_t i = 0; i < bases.size(); ++i) {
+        lo[i] = it - corpus.begin();
+        it = std::copy(bases[i].begin(), bases[i].end(), it);
+    }
+    lo.back() = it - corpus.begin();
+    std::copy(new_img.begin(), new_img.end(), it);
+
+    const index idx{corpus, prm.bits};
+
+    auto t1 = clock::now();
+
+    err e = err_ok;
+    for (size_t i = 0; e == err_ok && i < bases.size(); ++i)
+        e = dif::run(idx, lo[i], lo[i] + bases[i].size(), lo.back(), corpus.size(), outs[i], prm);
+
+    if (stats) {
+        stats->corpus = corpus.size();
+        stats->memory = idx.memory();
+        stats->build  = t1 - t0;
+        stats->match  = clock::now() - t1;
+    }
+    return e;
+}
+
+}
+
+#endif
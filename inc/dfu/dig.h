@@ -0,0 +1,378 @@
+#ifndef DFU_DIG_H
+#define DFU_DIG_H
+
+#include "dfu/app.h"
+#include <array>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define DFU_DIG_X86 1
+#include <cpuid.h>
+#include <immintrin.h>
+#else
+#define DFU_DIG_X86 0
+#endif
+
+namespace dfu {
+namespace dig {
+
+/**
+ * @brief CRC-32C (Castagnoli) lookup table, reflected polynomial.
+ * 
+ */
+inline constexpr auto crc_table = []()
+{
+    std::array<uint32_t, 256> t{};
+    for (uint32_t i = 0; i < 256; ++i) {
+        uint32_t c = i;
+        for (int k = 0; k < 8; ++k)
+            c = c & 1 ? (c >> 1) ^ 0x82f63b78 : c >> 1;
+        t[i] = c;
+    }
+    return t;
+}();
+
+inline constexpr uint32_t sha_k[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+};
+
+/**
+ * @brief Portable CRC-32C update, without pre- and post-inversion.
+ * 
+ */
+constexpr uint32_t crc32c_sw(uint32_t crc, span val)
+{
+    for (auto it : val)
+        crc = crc_table[(crc ^ it) & 0xff] ^ (crc >> 8);
+    return crc;
+}
+
+/**
+ * @brief Portable SHA-256 compression of whole 64-byte blocks.
+ * 
+ */
+constexpr void sha256_sw(uint32_t* state, pointer p, size_t blocks)
+{
+    auto ror = [](uint32_t x, int n) { return (x >> n) | (x << (32 - n)); };
+
+    for (; blocks--; p += 64) {
+        uint32_t w[64];
+        for (int i = 0; i < 16; ++i)
+            w[i] = uint32_t(p[i * 4]) << 24 | uint32_t(p[i * 4 + 1]) << 16 | uint32_t(p[i * 4 + 2]) << 8 | p[i * 4 + 3];
+        for (int i = 16; i < 64; ++i) {
+            uint32_t s0 = ror(w[i - 15], 7) ^ ror(w[i - 15], 18) ^ (w[i - 15] >> 3);
+            uint32_t s1 = ror(w[i - 2], 17) ^ ror(w[i - 2], 19) ^ (w[i - 2] >> 10);
+            w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+        }
+        uint32_t a = state[0], b = state[1], c = state[2], d = state[3];
+        uint32_t e = state[4], f = state[5], g = state[6], h = state[7];
+        for (int i = 0; i < 64; ++i) {
+            uint32_t t1 = h + (ror(e, 6) ^ ror(e, 11) ^ ror(e, 25)) + ((e & f) ^ (~e & g)) + sha_k[i] + w[i];
+            uint32_t t2 = (ror(a, 2) ^ ror(a, 13) ^ ror(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+            h = g; g = f; f = e; e = d + t1;
+            d = c; c = b; b = a; a = t1 + t2;
+        }
+        state[0] += a; state[1] += b; state[2] += c; state[3] += d;
+        state[4] += e; state[5] += f; state[6] += g; state[7] += h;
+    }
+}
+
+#if DFU_DIG_X86
+
+inline bool has_crc()
+{
+    static const bool res = []() {
+        unsigned a, b, c, d;
+        return __get_cpuid(1, &a, &b, &c, &d) && (c & bit_SSE4_2);
+    }();
+    return res;
+}
+
+inline bool has_sha()
+{
+    static const bool res = []() {
+        unsigned a, b, c, d;
+        if (!__get_cpuid(1, &a, &b, &c, &d) || !(c & bit_SSE4_1) || !(c & bit_SSSE3))
+            return false;
+        return __get_cpuid_count(7, 0, &a, &b, &c, &d) && (b & bit_SHA);
+    }();
+    return res;
+}
+
+/**
+ * @brief CRC-32C update with SSE4.2 crc32 instruction.
+ * 
+ */
+__attribute__((target("sse4.2")))
+inline uint32_t crc32c_hw(uint32_t crc, span val)
+{
+    pointer p = val.data();
+    size_t len = val.size();
+#ifdef __x86_64__
+    uint64_t c = crc;
+    for (; len >= 8; p += 8, len -= 8) {
+        uint64_t v;
+        __builtin_memcpy(&v, p, 8);
+        c = _mm_crc32_u64(c, v);
+    }
+    crc = uint32_t(c);
+#endif
+    for (; len >= 4; p += 4, len -= 4) {
+        uint32_t v;
+        __builtin_memcpy(&v, p, 4);
+        crc = _mm_crc32_u32(crc, v);
+    }
+    for (; len; ++p, --len)
+        crc = _mm_crc32_u8(crc, *p);
+    return crc;
+}
+
+/**
+ * @brief SHA-256 compression of whole 64-byte blocks with SHA-NI.
+ * 
+ */
+__attribute__((target("sha,sse4.1,ssse3")))
+inline void sha256_hw(uint32_t* state, pointer p, size_t blocks)
+{
+    const __m128i mask = _mm_set_epi64x(0x0c0d0e0f08090a0bull, 0x0405060700010203ull);
+
+    __m128i tmp = _mm_loadu_si128(reinterpret_cast<const __m128i*>(state));
+    __m128i st1 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(state + 4));
+    tmp = _mm_shuffle_epi32(tmp, 0xb1);             // CDAB
+    st1 = _mm_shuffle_epi32(st1, 0x1b);             // EFGH
+    __m128i st0 = _mm_alignr_epi8(tmp, st1, 8);     // ABEF
+    st1 = _mm_blend_epi16(st1, tmp, 0xf0);          // CDGH
+
+    for (; blocks--; p += 64) {
+        const __m128i abef = st0;
+        const __m128i cdgh = st1;
+        __m128i w[4];
+
+        for (int i = 0; i < 4; ++i)
+            w[i] = _mm_shuffle_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(p + i * 16)), mask);
+
+        for (int i = 0; i < 16; ++i) {
+            if (i >= 4) {
+                __m128i m = _mm_sha256msg1_epu32(w[i & 3], w[(i + 1) & 3]);
+                m = _mm_add_epi32(m, _mm_alignr_epi8(w[(i + 3) & 3], w[(i + 2) & 3], 4));
+                w[i & 3] = _mm_sha256msg2_epu32(m, w[(i + 3) & 3]);
+            }
+            __m128i m = _mm_add_epi32(w[i & 3], _mm_loadu_si128(reinterpret_cast<const __m128i*>(sha_k + i * 4)));
+            st1 = _mm_sha256rnds2_epu32(st1, st0, m);
+            st0 = _mm_sha256rnds2_epu32(st0, st1, _mm_shuffle_epi32(m, 0x0e));
+        }
+        st0 = _mm_add_epi32(st0, abef);
+        st1 = _mm_add_epi32(st1, cdgh);
+    }
+
+    tmp = _mm_shuffle_epi32(st0, 0x1b);             // FEBA
+    st1 = _mm_shuffle_epi32(st1, 0xb1);             // DCHG
+    st0 = _mm_blend_epi16(tmp, st1, 0xf0);          // DCBA
+    st1 = _mm_alignr_epi8(st1, tmp, 8);             // HGFE
+
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(state), st0);
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(state + 4), st1);
+}
+
+#else
+
+inline bool has_crc() { return false; }
+inline bool has_sha() { return false; }
+inline uint32_t crc32c_hw(uint32_t crc, span val)               { return crc32c_sw(crc, val); }
+inline void sha256_hw(uint32_t* state, pointer p, size_t blocks) { sha256_sw(state, p, blocks); }
+
+#endif
+
+}
+
+/**
+ * @brief Streaming CRC-32C, hardware accelerated when available.
+ * 
+ */
+struct crc32c {
+    static constexpr size_t length = 4;
+    void update(span val)
+    {
+        crc = dig::has_crc() ? dig::crc32c_hw(crc, val) : dig::crc32c_sw(crc, val);
+    }
+    std::array<byte, length> value() const
+    {
+        uint32_t v = ~crc;
+        return {byte(v), byte(v >> 8), byte(v >> 16), byte(v >> 24)};
+    }
+private:
+    uint32_t crc = ~0u;
+};
+
+/**
+ * @brief Streaming SHA-256, hardware accelerated when available.
+ * 
+ */
+struct sha256 {
+    static constexpr size_t length = 32;
+    void update(span val)
+    {
+        pointer p = val.data();
+        size_t len = val.size();
+        total += len;
+
+        if (fill) {
+            size_t n = std::min(len, sizeof(buf) - fill);
+            std::copy_n(p, n, buf + fill);
+            fill += n;
+            p += n;
+            len -= n;
+            if (fill < sizeof(buf))
+                return;
+            compress(buf, 1);
+            fill = 0;
+        }
+        if (len >= 64) {
+            compress(p, len / 64);
+            p += len & ~size_t(63);
+            len &= 63;
+        }
+        std::copy_n(p, len, buf);
+        fill = len;
+    }
+    std::array<byte, length> value() const
+    {
+        sha256 tmp = *this;
+        const uint64_t bits = total * 8;
+        const byte pad[64] = {0x80};
+        tmp.update({pad, 1 + (119 - fill) % 64});
+        byte end[8];
+        for (int i = 0; i < 8; ++i)
+            end[i] = bits >> (56 - i * 8);
+        tmp.update(end);
+
+        std::array<byte, length> res;
+        for (int i = 0; i < 32; ++i)
+            res[i] = tmp.state[i / 4] >> (24 - (i % 4) * 8);
+        return res;
+    }
+private:
+    void compress(pointer p, size_t blocks)
+    {
+        if (dig::has_sha())
+            dig::sha256_hw(state, p, blocks);
+        else
+            dig::sha256_sw(state, p, blocks);
+    }
+private:
+    uint32_t state[8] = {
+        0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+        0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19,
+    };
+    byte buf[64]{};
+    size_t fill = 0;
+    uint64_t total = 0;
+};
+
+/**
+ * @brief Digest algorithm identifier, as stored in patch container.
+ * 
+ */
+enum digest_kind : byte {
+    digest_none,
+    digest_crc32c,
+    digest_sha256,
+};
+
+/**
+ * @brief Digest of an image together with its size.
+ * 
+ */
+struct digest {
+    constexpr size_t length() const
+    {
+        return kind == digest_crc32c ? crc32c::length : kind == digest_sha256 ? sha256::length : 0;
+    }
+    constexpr bool operator==(const digest& o) const
+    {
+        return kind == o.kind && size == o.size && std::equal(val, val + length(), o.val);
+    }
+    digest_kind kind = digest_none;
+    uint32_t size = 0;
+    byte val[32]{};
+};
+
+/**
+ * @brief Streaming digest of runtime selected kind.
+ * 
+ */
+struct digester {
+    digester(digest_kind kind = digest_none) : kind{kind} {}
+    void update(span val)
+    {
+        size += val.size();
+        if (kind == digest_crc32c)
+            crc.update(val);
+        else if (kind == digest_sha256)
+            sha.update(val);
+    }
+    digest value() const
+    {
+        digest res{kind, uint32_t(size)};
+        if (kind == digest_crc32c)
+            std::ranges::copy(crc.value(), res.val);
+        else if (kind == digest_sha256)
+            std::ranges::copy(sha.value(), res.val);
+        return res;
+    }
+private:
+    digest_kind kind;
+    size_t size = 0;
+    crc32c crc;
+    sha256 sha;
+};
+
+/**
+ * @brief Device adapter which feeds every written byte into a digest on
+ * the fly, so target image doesn't have to be read back after apply.
+ * Optional fill() and seek() of underlying device are passed through,
+ * digest covers bytes in order they're written.
+ * 
+ * @tparam D Underlying device type
+ * @tparam H Digest type with update(span)
+ */
+template<device D, class H = digester>
+struct hashing {
+    hashing(D& dev, H& hash) : dev{dev}, hash{hash} {}
+    err write(pointer src, size_t len)
+    {
+        err e = dev.write(src, len);
+        if (e == err_ok)
+            hash.update({src, len});
+        return e;
+    }
+    err fill(byte val, size_t len) requires fillable<D>
+    {
+        err e = dev.fill(val, len);
+        if (e == err_ok) {
+            byte tmp[64];
+            std::fill_n(tmp, sizeof(tmp), val);
+            for (size_t done = 0, n; done < len; done += n) {
+                n = std::min(len - done, sizeof(tmp));
+                hash.update({tmp, n});
+            }
+        }
+        return e;
+    }
+    err seek(size_t addr) requires seekable<D>          { return dev.seek(addr); }
+    err read_old(size_t addr, byte* dst, size_t len)    { return dev.read_old(addr, dst, len); }
+    err read_new(size_t addr, byte* dst, size_t len)    { return dev.read_new(addr, dst, len); }
+private:
+    D& dev;
+    H& hash;
+};
+
+}
+
+#endif
@@ -3,10 +3,23 @@
 
 #include "dfu/dec.h"
 #include <algorithm>
+#include <array>
 
 namespace dfu {
 namespace enc {
 
+/**
+ * @brief Encoded size of chunk header for given chunk size.
+ * 
+ * @param len Chunk size, non-zero
+ * @return Header size in bytes 
+ */
+constexpr size_t head_len(size_t len)
+{
+    --len;
+    return len <= 0xf ? 1 : len <= 0xfff ? 2 : len <= 0xfffff ? 3 : 4;
+}
+
 template<class T>
 struct interface {
 
@@ -60,15 +73,19 @@ struct interface {
     }
     constexpr err encode_off(int32_t val, size_t len)
     {
-        byte ai;
-        if (val >= -0x20 && val < 0x20)
-            ai = 0;
-        else if (val >= -0x2000 && val < 0x2000)
-            ai = 1;
-        else if (val >= -0x200000 && val < 0x200000)
-            ai = 2;
-        else
-            ai = 3;
+        return encode_offs(val, offset_width(val), len);
+    }
+    constexpr err encode_cpy(size_t dist, size_t len)
+    {
+        if (!dist || dist >= 0x200000)
+            return err_invalid_size;
+        return encode_offs(dist, offset_width(dist) + 1, len);
+    }
+private:
+    constexpr err encode_offs(int32_t val, int ai, size_t len)
+    {
+        if (ai > 3)
+            return err_invalid_size;
         byte tmp[4] = {
             byte(((val & 0x3f) << 2) | ai),
             byte(  val >>   6),
@@ -77,9 +94,10 @@ struct interface {
         };
         if (val < 0)
             tmp[ai] |= 0x80;
+        else
+            tmp[ai] &= 0x7f;
         return encode_general(type_off, len, tmp, ai + 1);
     }
-private:
     constexpr err encode_head(chunk_type ct, size_t cs, size_t add_len = 0) // NOTE: add_len is only to check if enough capacity
     {
         byte ai;
@@ -203,6 +221,64 @@ private:
     byte buf[N]{};
 };
 
+namespace enc {
+
+/**
+ * @brief Codec which remembers first failed encode, so that builder 
+ * errors can't go unnoticed in dfu::build().
+ * 
+ * @tparam N Buffer size in bytes
+ */
+template<size_t N>
+struct tracked : codec<N> {
+    constexpr err encode_raw(span val)              { return note(codec<N>::encode_raw(val)); }
+    constexpr err encode_raw(list val)              { return note(codec<N>::encode_raw(val)); }
+    constexpr err encode_rep(byte val, size_t rep)  { return note(codec<N>::encode_rep(val, rep)); }
+    constexpr err encode_arr(span val, size_t rep)  { return note(codec<N>::encode_arr(val, rep)); }
+    constexpr err encode_arr(list val, size_t rep)  { return note(codec<N>::encode_arr(val, rep)); }
+    constexpr err encode_off(int32_t val, size_t len)   { return note(codec<N>::encode_off(val, len)); }
+    constexpr err encode_cpy(size_t dist, size_t len)   { return note(codec<N>::encode_cpy(dist, len)); }
+    constexpr err status() const                    { return e; }
+private:
+    constexpr err note(err res)
+    {
+        if (e == err_ok)
+            e = res;
+        return res;
+    }
+private:
+    err e = err_ok;
+};
+
+}
+
+/**
+ * @brief Encode at compile time into std::array of exactly encoded size. 
+ * Builder is a captureless lambda which takes codec by reference (use 
+ * auto&) and calls encode_*() on it. It is run in scratch codec first 
+ * to measure size. Failed encode or malformed result fails the build.
+ * 
+ * @tparam Max Scratch buffer size in bytes
+ * @tparam F Captureless builder type
+ * @return Encoded sequence
+ */
+template<size_t Max = 4096, class F>
+consteval auto build(F)
+{
+    constexpr auto tmp = []()
+    {
+        enc::tracked<Max> c;
+        F{}(c);
+        return c;
+    }();
+    static_assert(tmp.status() == err_ok, "dfu::build() encode failed, bad argument or too small Max");
+    static_assert(validate(tmp) == err_ok, "dfu::build() produced malformed sequence");
+
+    std::array<byte, tmp.size()> res{};
+    std::copy_n(tmp.data(), tmp.size(), res.begin());
+    return res;
+}
+
 }
 
 #endif
\ No newline at end of file
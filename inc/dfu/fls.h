@@ -0,0 +1,220 @@
+#ifndef DFU_FLS_H
+#define DFU_FLS_H
+
+#include "dfu/app.h"
+#include <chrono>
+#include <vector>
+
+namespace dfu {
+
+/**
+ * @brief Raw flash requirements for dfu::flash_writer. Pages must be
+ * erased before programming, erase works on whole page at aligned address.
+ * 
+ */
+template<class T>
+concept flash = requires(T& fls, byte* dst, pointer src, size_t addr, size_t len) {
+    { fls.page() } -> std::convertible_to<size_t>;
+    { fls.erase(addr) } -> std::same_as<err>;
+    { fls.program(addr, src, len) } -> std::same_as<err>;
+    { fls.read(addr, dst, len) } -> std::same_as<err>;
+    { fls.read_old(addr, dst, len) } -> std::same_as<err>;
+};
+
+/**
+ * @brief Work done on flash by dfu::flash_writer.
+ * 
+ */
+struct flash_stats {
+    size_t erases       = 0;    // Pages erased
+    size_t programs     = 0;    // Program operations
+    size_t programmed   = 0;    // Bytes programmed
+    size_t skipped      = 0;    // Bytes left erased instead of programmed
+};
+
+/**
+ * @brief Device adapter which writes new image into raw flash. Every page
+ * is erased when output enters it, unless already known to be erased, and
+ * after that runs of erased value aren't programmed at all, since they
+ * already read back as such. REP of erased value goes through fill() and
+ * costs no flash operation besides erase.
+ * 
+ * @tparam F Flash type, see dfu::flash
+ */
+template<flash F>
+struct flash_writer {
+    static constexpr size_t gap = 16;
+
+    flash_writer(F& fls, size_t size, byte erased = 0xff, bool elide = true) :
+        fls{fls}, pages((size + fls.page() - 1) / fls.page()), cap{size}, erased{erased}, elide{elide} {}
+
+    const flash_stats& stats() const    { return cnt; }
+    size_t size() const                 { return idx; }
+
+    /**
+     * @brief Mark pages as erased in advance, e.g. after mass erase, so
+     * they aren't erased again. Range is rounded inwards to whole pages.
+     * 
+     */
+    void mark_erased(size_t addr, size_t len)
+    {
+        const size_t pg = fls.page();
+        for (size_t p = (addr + pg - 1) / pg; p < pages.size() && (p + 1) * pg <= addr + len; ++p)
+            pages[p] = true;
+    }
+    err write(pointer src, size_t len)
+    {
+        return put(len, [&](size_t done, size_t n) {
+            const pointer base = src + done;
+            const pointer end = base + n;
+            for (pointer p = base, q, r; p < end; p = r) {
+                q = r = elide ? p : end;
+                while (q < end) {
+                    q = std::find(r, end, erased);
+                    r = std::find_if(q, end, [&](byte b) { return b != erased; });
+                    if (q == p || r == end || size_t(r - q) >= gap) // NOTE: Short run inside isn't worth another program operation
+                        break;
+                }
+                if (p < q) {
+                    err e = fls.program(idx + (p - base), p, q - p);
+                    if (e != err_ok)
+                        return e;
+                    ++cnt.programs;
+                    cnt.programmed += q - p;
+                }
+                cnt.skipped += r - q;
+            }
+            return err_ok;
+        });
+    }
+    err fill(byte val, size_t len)
+    {
+        if (!elide || val != erased) {
+            byte tmp[256];
+            std::fill_n(tmp, sizeof(tmp), val);
+            err e = err_ok;
+            for (size_t done = 0, n; e == err_ok && done < len; done += n) {
+                n = std::min(len - done, sizeof(tmp));
+                e = write(tmp, n);
+            }
+            return e;
+        }
+        return put(len, [&](size_t, size_t n) {
+            cnt.skipped += n;
+            return err_ok;
+        });
+    }
+    err read_old(size_t addr, byte* dst, size_t len)
+    {
+        return fls.read_old(addr, dst, len);
+    }
+    err read_new(size_t addr, byte* dst, size_t len)
+    {
+        if (addr > idx || len > idx - addr)
+            return err_out_of_bounds;
+        return fls.read(addr, dst, len);
+    }
+private:
+    /**
+     * @brief Advance output by len bytes page by page, erasing each page
+     * on entry if needed, and call handler for every in-page piece.
+     * 
+     */
+    template<class H>
+    err put(size_t len, H&& handle)
+    {
+        const size_t pg = fls.page();
+        if (len > cap - idx)
+            return err_no_memory;
+        for (size_t done = 0, n; done < len; done += n, idx += n) {
+            const size_t p = idx / pg;
+            n = std::min(len - done, (p + 1) * pg - idx);
+            if (!pages[p]) {
+                err e = fls.erase(p * pg);
+                if (e != err_ok)
+                    return e;
+                ++cnt.erases;
+                pages[p] = true;
+            }
+            err e = handle(done, n);
+            if (e != err_ok)
+                return e;
+        }
+        return err_ok;
+    }
+private:
+    F& fls;
+    std::vector<bool> pages;    // NOTE: Erased pages, below output position only partially
+    size_t cap;
+    size_t idx = 0;
+    flash_stats cnt;
+    byte erased;
+    bool elide;
+};
+
+/**
+ * @brief Operation timing of simulated flash.
+ * 
+ */
+struct flash_timing {
+    std::chrono::nanoseconds erase      = std::chrono::milliseconds(20);    // Per page
+    std::chrono::nanoseconds program    = std::chrono::microseconds(10);    // Per operation setup
+    std::chrono::nanoseconds per_byte   = std::chrono::microseconds(5);     // Per programmed byte
+};
+
+/**
+ * @brief Simulated NOR flash for host side testing: erase sets page to
+ * 0xff, program can only clear bits, just like real one, so programming
+ * non-erased byte shows up as corrupted image. Accumulates time according
+ * to timing model.
+ * 
+ */
+struct sim_flash {
+    sim_flash(span old, size_t size, size_t pg, flash_timing tm = {}) : old{old}, mem(size), pg{pg}, tm{tm} {}
+
+    size_t page() const                 { return pg; }
+    span image() const                  { return mem; }
+    std::chrono::nanoseconds elapsed() const { return time; }
+
+    err erase(size_t addr)
+    {
+        if (addr % pg || addr >= mem.size())
+            return err_out_of_bounds;
+        std::fill_n(mem.begin() + addr, std::min(pg, mem.size() - addr), 0xff);
+        time += tm.erase;
+        return err_ok;
+    }
+    err program(size_t addr, pointer src, size_t len)
+    {
+        if (addr > mem.size() || len > mem.size() - addr)
+            return err_out_of_bounds;
+        for (size_t i = 0; i < len; ++i)
+            mem[addr + i] &= src[i];
+        time += tm.program + tm.per_byte * len;
+        return err_ok;
+    }
+    err read(size_t addr, byte* dst, size_t len) const
+    {
+        if (addr > mem.size() || len > mem.size() - addr)
+            return err_out_of_bounds;
+        std::copy_n(mem.begin() + addr, len, dst);
+        return err_ok;
+    }
+    err read_old(size_t addr, byte* dst, size_t len) const
+    {
+        if (addr > old.size() || len > old.size() - addr)
+            return err_out_of_bounds;
+        std::copy_n(old.begin() + addr, len, dst);
+        return err_ok;
+    }
+private:
+    span old;
+    std::vector<byte> mem;
+    size_t pg;
+    flash_timing tm;
+    std::chrono::nanoseconds time{};
+};
+
+}
+
+#endif
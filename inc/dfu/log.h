@@ -100,6 +100,9 @@ inline void log_obj(const chunk& obj)
     case type_off:
         printf("%sOLD [%9lu] offs %+d \n", log::mag, obj.size, obj.off);
     break;
+    case type_cpy:
+        printf("%sCPY [%9lu] dist %u \n", log::yel, obj.size, obj.cpy);
+    break;
     case type_invalid:
         printf("<invalid> \n");
     break;
@@ -0,0 +1,193 @@
+#ifndef DFU_OPT_H
+#define DFU_OPT_H
+
+#include "dfu/cmp.h"
+
+namespace dfu {
+
+/**
+ * @brief Size report of dfu::reoptimize() run.
+ * 
+ */
+struct opt_stats {
+    size_t input    = 0;    // Bytes of original sequence
+    size_t output   = 0;    // Bytes of reoptimized sequence
+    constexpr int64_t saved() const { return int64_t(input) - int64_t(output); }
+};
+
+namespace opt {
+
+inline constexpr size_t max_period = 16;   // Longest ARR pattern searched in RAW data
+
+/**
+ * @brief Re-select encoding of literal bytes: runs of same byte become
+ * REP and short periodic patterns become ARR, where it pays off against
+ * splitting RAW, the rest goes out as RAW. Split is taken only if RAW
+ * before, chunk and RAW after together cost less than one RAW of pending
+ * literals, so every split makes output strictly smaller.
+ * 
+ */
+inline err literal(span b, merger& mrg)
+{
+    err e = err_ok;
+    size_t lit = 0;
+
+    auto raw = [&](size_t end) { // NOTE: Empty piece would flush pending REP, which may still merge
+        if (e == err_ok && end > lit)
+            e = mrg.raw(b.subspan(lit, end - lit));
+    };
+    auto head = [](size_t len) -> size_t {
+        return len ? enc::head_len(len) : 0;
+    };
+    auto gain = [&](size_t at, size_t len, size_t cost) { // NOTE: Bytes saved by splitting [at, at + len) out of pending RAW
+        return int64_t(head(b.size() - lit) + len) - int64_t(head(at - lit) + cost + head(b.size() - at - len));
+    };
+
+    for (size_t i = 0; e == err_ok && i < b.size();) {
+
+        size_t run = 1;
+        while (i + run < b.size() && b[i + run] == b[i])
+            ++run;
+        if (gain(i, run, enc::head_len(run) + 1) > 0) {
+            raw(i);
+            if (e == err_ok)
+                e = mrg.rep(b[i], run);
+            i += run;
+            lit = i;
+            continue;
+        }
+        size_t best_p = 0;
+        size_t best_k = 0;
+        int64_t best = 0;
+
+        for (size_t p = 2; p <= max_period && i + 2 * p <= b.size(); ++p) {
+            size_t k = 1;
+            while (k < 0x100 && i + (k + 1) * p <= b.size() && std::equal(b.begin() + i, b.begin() + i + p, b.begin() + i + k * p))
+                ++k;
+            const int64_t g = gain(i, k * p, enc::head_len(p) + 1 + p);
+            if (g > best) {
+                best = g;
+                best_p = p;
+                best_k = k;
+            }
+        }
+        if (best_p) {
+            raw(i);
+            if (e == err_ok)
+                e = mrg.arr(b.subspan(i, best_p), best_k);
+            i += best_p * best_k;
+            lit = i;
+            continue;
+        }
+        ++i;
+    }
+    raw(b.size());
+    return e;
+}
+
+}
+
+/**
+ * @brief Peephole pass over existing sequence, e.g. from older or third
+ * party encoder. In single linear pass adjacent RAW chunks are merged,
+ * REP of same byte, OFF of same offset and CPY of same distance are
+ * joined, REP/ARR (and OFF, if old image is given) which cost more than
+ * their bytes added to literals are turned into literals, literals are
+ * re-scanned for REP/ARR, and every header gets minimal width. Output is
+ * never larger and reconstructed image stays identical.
+ * 
+ * @param s Encoded sequence, output keeps its extension
+ * @param old Old image, optional, needed only to inline short OFF
+ * @param out Output codec
+ * @param stats Optional size report
+ * @return First error encountered or err_ok
+ */
+inline err reoptimize(seq s, span old, ref out, opt_stats* stats = nullptr)
+{
+    merger mrg{out};
+    std::vector<byte> lit;
+    size_t pos = 0;
+    const size_t start = out.size();
+    err e = err_ok;
+
+    auto flush = [&]() {
+        if (e == err_ok && !lit.empty())
+            e = opt::literal(lit, mrg);
+        lit.clear();
+    };
+
+    for (pointer p = s.data(), end = p + s.size(); e == err_ok && p < end;) {
+        auto [cnk, de, next] = decode(p, end, s.ext);
+        if (de != err_ok)
+            return de;
+
+        const size_t len = cnk.type == type_arr ? cnk.size * cnk.arr.reps : cnk.size;
+        const size_t cost = next - p;
+        const size_t grow = lit.empty() ? enc::head_len(len) + len : enc::head_len(lit.size() + len) + len - enc::head_len(lit.size());
+        const bool cheap = grow <= cost; // NOTE: Inlined bytes must cost no more than chunk itself
+
+        bool keep = true;
+
+        switch (cnk.type)
+        {
+        case type_raw:
+            lit.insert(lit.end(), cnk.raw, cnk.raw + cnk.size);
+            keep = false;
+        break;
+        case type_rep:
+            if (cheap) {
+                lit.insert(lit.end(), len, cnk.rep);
+                keep = false;
+            }
+        break;
+        case type_arr:
+            if (cheap) {
+                for (size_t i = 0; i < cnk.arr.reps; ++i)
+                    lit.insert(lit.end(), cnk.arr.data, cnk.arr.data + cnk.size);
+                keep = false;
+            }
+        break;
+        case type_off:
+            if (!old.empty()) {
+                const int64_t addr = int64_t(pos) + cnk.off;
+                if (addr < 0 || size_t(addr) > old.size() || len > old.size() - addr)
+                    return err_out_of_bounds;
+                if (!cheap)
+                    break;
+                lit.insert(lit.end(), old.begin() + addr, old.begin() + addr + len);
+                keep = false;
+            }
+        break;
+        default:;
+        }
+        if (keep) {
+            flush();
+            if (e == err_ok)
+                e = mrg.put(cnk);
+        }
+        pos += len;
+        p = next;
+    }
+    flush();
+    if (e == err_ok)
+        e = mrg.flush();
+
+    if (stats) {
+        stats->input  = s.size();
+        stats->output = out.size() - start;
+    }
+    return e;
+}
+
+/**
+ * @brief Same as dfu::reoptimize() with old image, but keeps every OFF.
+ * 
+ */
+inline err reoptimize(seq s, ref out, opt_stats* stats = nullptr)
+{
+    return reoptimize(s, {}, out, stats);
+}
+
+}
+
+#endif
@@ -0,0 +1,393 @@
+#ifndef DFU_PAK_H
+#define DFU_PAK_H
+
+#include "dfu/dig.h"
+
+namespace dfu {
+namespace pak {
+
+inline constexpr byte magic[3]  = {'D', 'F', 'U'};
+inline constexpr byte version   = 1;
+inline constexpr byte has_src   = 0b0000'0001;
+inline constexpr byte has_dst   = 0b0000'0010;
+inline constexpr byte has_cpy   = 0b0000'0100; // Body uses CPY extension, which older decoders take for OFF
+inline constexpr byte known     = has_src | has_dst | has_cpy;
+inline constexpr byte sections  = 2;            // Version of multi-section container
+inline constexpr size_t entry   = 18;           // Section table entry without digests
+
+inline uint32_t get_u32(pointer& p)
+{
+    uint32_t val = 0;
+    for (int i = 0; i < 32; i += 8)
+        val |= uint32_t(*p++) << i;
+    return val;
+}
+
+inline void put_u32(byte*& p, uint32_t val)
+{
+    for (int i = 0; i < 32; i += 8)
+        *p++ = val >> i;
+}
+
+/**
+ * @brief Get feature flags required by sequence, i.e. has_cpy if it is
+ * read with dfu::ext_cpy and contains any CPY chunk.
+ * 
+ */
+inline byte features(seq s)
+{
+    byte res = 0;
+    for (auto it : s)
+        if (it.type == type_cpy)
+            res |= has_cpy;
+    return res;
+}
+
+/**
+ * @brief Decoder extension of body according to flags. Without has_cpy
+ * padded OFF stays OFF, as producers before the extension meant it.
+ * 
+ */
+inline extension body_ext(byte flags)
+{
+    return flags & has_cpy ? ext_cpy : ext_none;
+}
+
+/**
+ * @brief Parse digests present according to flags.
+ * 
+ */
+inline err get_digests(pointer& p, pointer end, byte flags, digest& src, digest& dst)
+{
+    for (auto [bit, dig] : {std::pair{has_src, &src}, std::pair{has_dst, &dst}}) {
+        if (!(flags & bit))
+            continue;
+        if (end - p < 5)
+            return err_out_of_bounds;
+        dig->kind = digest_kind(*p++);
+        if (dig->kind != digest_crc32c && dig->kind != digest_sha256)
+            return err_invalid_size;
+        dig->size = get_u32(p);
+        if (size_t(end - p) < dig->length())
+            return err_out_of_bounds;
+        std::copy_n(p, dig->length(), dig->val);
+        p += dig->length();
+    }
+    return err_ok;
+}
+
+/**
+ * @brief Store digests which are present, return their flags.
+ * 
+ */
+inline byte put_digests(byte*& p, const digest& src, const digest& dst)
+{
+    for (auto dig : {&src, &dst}) {
+        if (dig->kind == digest_none)
+            continue;
+        *p++ = dig->kind;
+        put_u32(p, dig->size);
+        p = std::copy_n(dig->val, dig->length(), p);
+    }
+    return (src.kind != digest_none ? has_src : 0) | (dst.kind != digest_none ? has_dst : 0);
+}
+
+inline size_t digests_len(const digest& src, const digest& dst)
+{
+    size_t len = 0;
+    for (auto dig : {&src, &dst})
+        len += dig->kind != digest_none ? 5 + dig->length() : 0;
+    return len;
+}
+
+}
+
+/**
+ * @brief Patch container: encoded sequence with optional digests of
+ * source (old) and target (new) image, each together with image size.
+ * Layout is magic "DFU", version, flags, then for each present digest
+ * its kind, little-endian 32-bit size and value, then sequence till end.
+ * Flag has_cpy marks body with CPY chunks, so decoders which don't know
+ * the extension can refuse it instead of applying CPY as OFF, and body
+ * is read with dfu::ext_cpy only when it is set.
+ * 
+ */
+struct package {
+    digest src;
+    digest dst;
+    seq body;
+};
+
+/**
+ * @brief Parse patch container.
+ * 
+ * @param in Container bytes
+ * @return Tuple with package, which body points into input, and err status
+ */
+inline std::tuple<package, err> unpack(span in)
+{
+    package pkg;
+    pointer p = in.data();
+    pointer end = p + in.size();
+
+    if (in.size() < 5 || !std::equal(pak::magic, pak::magic + 3, p) || p[3] != pak::version || p[4] & ~pak::known)
+        return {pkg, err_invalid_size};
+    const byte flags = p[4];
+    p += 5;
+
+    if (err e = pak::get_digests(p, end, flags, pkg.src, pkg.dst); e != err_ok)
+        return {pkg, e};
+    pkg.body = seq{p, size_t(end - p), pak::body_ext(flags)};
+    return {pkg, err_ok};
+}
+
+/**
+ * @brief Serialize patch container. Digests of kind digest_none are omitted.
+ * 
+ * @param pkg Package to store
+ * @param out Output memory
+ * @param len Resulting size in bytes
+ * @return err_no_memory if doesn't fit, otherwise err_ok
+ */
+inline err pack(const package& pkg, std::span<byte> out, size_t& len)
+{
+    const size_t need = 5 + pak::digests_len(pkg.src, pkg.dst) + pkg.body.size();
+    if (need > out.size())
+        return err_no_memory;
+
+    byte* p = std::copy_n(pak::magic, 3, out.data());
+    *p++ = pak::version;
+    byte* flags = p++;
+    *flags = pak::put_digests(p, pkg.src, pkg.dst) | pak::features(pkg.body);
+    std::copy_n(pkg.body.data(), pkg.body.size(), p);
+    len = need;
+    return err_ok;
+}
+
+/**
+ * @brief Compute digest of whole image in memory, for host side packing.
+ * 
+ */
+inline digest digest_of(digest_kind kind, span img)
+{
+    digester dig{kind};
+    dig.update(img);
+    return dig.value();
+}
+
+/**
+ * @brief Apply package with verification. Source digest, if present, is
+ * checked by reading old image before anything is written. Target digest
+ * is computed on the fly while chunks are written, so new image is never
+ * read back.
+ * 
+ * @param pkg Unpacked container
+ * @param dev Output device
+ * @return err_mismatch if any digest doesn't match, otherwise as dfu::apply()
+ */
+template<device D>
+err apply(const package& pkg, D& dev)
+{
+    if (pkg.src.kind != digest_none) {
+        digester dig{pkg.src.kind};
+        byte tmp[256];
+        for (size_t done = 0, n; done < pkg.src.size; done += n) {
+            n = std::min<size_t>(pkg.src.size - done, sizeof(tmp));
+            err e = dev.read_old(done, tmp, n);
+            if (e != err_ok)
+                return e;
+            dig.update({tmp, n});
+        }
+        if (dig.value() != pkg.src)
+            return err_mismatch;
+    }
+    digester dig{pkg.dst.kind};
+    hashing<D> tap{dev, dig};
+
+    err e = apply(pkg.body, tap);
+    if (e == err_ok && pkg.dst.kind != digest_none && dig.value() != pkg.dst)
+        return err_mismatch;
+    return e;
+}
+
+/**
+ * @brief Section of multi-partition container: patch of one partition,
+ * with its old image at given base address of old image space, expected
+ * output size and optional digests. Body is plain sequence, decodable on
+ * its own, so sections can be produced, verified and applied in any order.
+ * 
+ */
+struct section {
+    byte part       = 0;    // Target partition id
+    uint32_t base   = 0;    // Old image base address
+    uint32_t size   = 0;    // Output size
+    digest src;
+    digest dst;
+    seq body;
+};
+
+/**
+ * @brief Device adapter which shifts old image reads by section base and
+ * rejects writes past section output size before they reach the device.
+ * Optional fill() and seek() of underlying device are passed through.
+ * 
+ */
+template<device D>
+struct rebased {
+    rebased(D& dev, size_t base, size_t cap) : dev{dev}, base{base}, cap{cap} {}
+    size_t size() const { return idx; }
+    err write(pointer src, size_t len)
+    {
+        if (len > cap - idx)
+            return err_out_of_bounds;
+        err e = dev.write(src, len);
+        if (e == err_ok)
+            idx += len;
+        return e;
+    }
+    err fill(byte val, size_t len) requires fillable<D>
+    {
+        if (len > cap - idx)
+            return err_out_of_bounds;
+        err e = dev.fill(val, len);
+        if (e == err_ok)
+            idx += len;
+        return e;
+    }
+    err seek(size_t addr) requires seekable<D>
+    {
+        if (addr > cap)
+            return err_out_of_bounds;
+        err e = dev.seek(addr);
+        if (e == err_ok)
+            idx = addr;
+        return e;
+    }
+    err read_old(size_t addr, byte* dst, size_t len)    { return dev.read_old(base + addr, dst, len); }
+    err read_new(size_t addr, byte* dst, size_t len)    { return dev.read_new(addr, dst, len); }
+private:
+    D& dev;
+    size_t base;
+    size_t cap;
+    size_t idx = 0;
+};
+
+/**
+ * @brief Parse multi-section container. Layout is magic "DFU", version 2,
+ * section count, then table with entry per section: partition id, flags,
+ * little-endian 32-bit old base, output size, stream offset from start of
+ * container and stream length, followed by digests as in dfu::package. 
+ * Streams follow the table.
+ * 
+ * @param in Container bytes
+ * @param out Sections, which bodies point into input
+ * @return Tuple with number of sections and err status
+ */
+inline std::tuple<size_t, err> unpack(span in, std::span<section> out)
+{
+    pointer p = in.data();
+    pointer end = p + in.size();
+
+    if (in.size() < 5 || !std::equal(pak::magic, pak::magic + 3, p) || p[3] != pak::sections)
+        return {0, err_invalid_size};
+    const size_t cnt = p[4];
+    p += 5;
+
+    if (cnt > out.size())
+        return {0, err_no_memory};
+
+    for (auto& sec : std::span{out.data(), cnt}) {
+        if (size_t(end - p) < pak::entry)
+            return {0, err_out_of_bounds};
+        sec = {};
+        sec.part = *p++;
+        const byte flags = *p++;
+        if (flags & ~pak::known)
+            return {0, err_invalid_size};
+        sec.base = pak::get_u32(p);
+        sec.size = pak::get_u32(p);
+        const size_t offs = pak::get_u32(p);
+        const size_t len  = pak::get_u32(p);
+        if (offs > in.size() || len > in.size() - offs)
+            return {0, err_out_of_bounds};
+        if (err e = pak::get_digests(p, end, flags, sec.src, sec.dst); e != err_ok)
+            return {0, e};
+        sec.body = seq{in.data() + offs, len, pak::body_ext(flags)};
+    }
+    for (auto& sec : std::span{out.data(), cnt})
+        if (sec.body.data() < p)
+            return {0, err_invalid_size}; // NOTE: Stream overlapping table
+    return {cnt, err_ok};
+}
+
+/**
+ * @brief Serialize multi-section container, streams are stored in given
+ * order right after the table.
+ * 
+ * @param secs Sections to store, at most 255
+ * @param out Output memory
+ * @param len Resulting size in bytes
+ * @return err_no_memory if doesn't fit, err_invalid_size for too many 
+ * sections or container over 4 GiB, otherwise err_ok
+ */
+inline err pack(std::span<const section> secs, std::span<byte> out, size_t& len)
+{
+    if (secs.size() > 0xff)
+        return err_invalid_size;
+
+    size_t table = 5;
+    size_t need = 0;
+    for (auto& sec : secs) {
+        table += pak::entry + pak::digests_len(sec.src, sec.dst);
+        need += sec.body.size();
+    }
+    need += table;
+    if (need > UINT32_MAX)
+        return err_invalid_size;
+    if (need > out.size())
+        return err_no_memory;
+
+    byte* p = std::copy_n(pak::magic, 3, out.data());
+    *p++ = pak::sections;
+    *p++ = secs.size();
+
+    size_t offs = table;
+    for (auto& sec : secs) {
+        *p++ = sec.part;
+        byte* flags = p++;
+        pak::put_u32(p, sec.base);
+        pak::put_u32(p, sec.size);
+        pak::put_u32(p, offs);
+        pak::put_u32(p, sec.body.size());
+        *flags = pak::put_digests(p, sec.src, sec.dst) | pak::features(sec.body);
+        std::copy_n(sec.body.data(), sec.body.size(), out.data() + offs);
+        offs += sec.body.size();
+    }
+    len = need;
+    return err_ok;
+}
+
+/**
+ * @brief Apply single section with verification, to device which output
+ * is target partition. Old image is read at section base.
+ * 
+ * @param sec Unpacked section
+ * @param dev Output device
+ * @return err_out_of_bounds if stream writes past output size, 
+ * err_mismatch if any digest or output size doesn't match, otherwise 
+ * as dfu::apply()
+ */
+template<device D>
+err apply(const section& sec, D& dev)
+{
+    rebased<D> tap{dev, sec.base, sec.size};
+
+    err e = apply(package{sec.src, sec.dst, sec.body}, tap);
+    if (e == err_ok && tap.size() != sec.size)
+        return err_mismatch;
+    return e;
+}
+
+}
+
+#endif
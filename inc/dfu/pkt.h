@@ -0,0 +1,163 @@
+#ifndef DFU_PKT_H
+#define DFU_PKT_H
+
+#include "dfu/app.h"
+#include "dfu/enc.h"
+#include <vector>
+
+namespace dfu {
+namespace pkt {
+
+inline constexpr size_t head_len    = 4;            // Output address, little-endian
+inline constexpr size_t min_mtu     = head_len + 8; // Longest OFF or CPY chunk fits
+
+}
+
+/**
+ * @brief Byte overhead of dfu::packetize() run.
+ * 
+ */
+struct pkt_stats {
+    size_t frames   = 0;    // Number of frames emitted
+    size_t input    = 0;    // Bytes of original sequence
+    size_t output   = 0;    // Bytes of all frames, including addresses
+    constexpr size_t overhead() const { return output - input; }
+};
+
+/**
+ * @brief Cut encoded sequence into frames of at most MTU bytes. Every
+ * frame starts with output address of its first chunk, followed by
+ * complete chunks, so it can be applied on its own. RAW chunks are
+ * split to fill frames up, ARR with pattern too long for a frame is
+ * expanded into RAW, other chunks are moved to next frame whole. Note
+ * that CPY still needs earlier output to be applied before.
+ * 
+ * @param s Encoded sequence, frames keep its extension, see dfu::apply_frame()
+ * @param mtu Maximum frame size, at least pkt::min_mtu
+ * @param emit Callable with frame as span, returning err
+ * @param stats Optional overhead report
+ * @return First error encountered, including one returned from emit, or err_ok
+ */
+template<class F>
+err packetize(seq s, size_t mtu, F&& emit, pkt_stats* stats = nullptr)
+{
+    if (mtu < pkt::min_mtu)
+        return err_invalid_size;
+
+    std::vector<byte> buf(mtu);
+    view frm{buf};
+    size_t pos = 0;
+    pkt_stats st{.input = s.size()};
+
+    auto begin = [&]() {
+        for (size_t i = 0; i < pkt::head_len; ++i)
+            buf[i] = pos >> (i * 8);
+        frm.resize(pkt::head_len);
+    };
+    auto ship = [&]() -> err {
+        err e = err_ok;
+        if (frm.size() > pkt::head_len) {
+            e = emit(span{frm.data(), frm.size()});
+            st.frames += 1;
+            st.output += frm.size();
+        }
+        begin();
+        return e;
+    };
+    auto raw = [&](pointer p, size_t len) -> err {
+        err e = err_ok;
+        while (e == err_ok && len) {
+            size_t n = std::min(len, mtu - frm.size());
+            while (n && enc::head_len(n) + n > mtu - frm.size())
+                --n;
+            if (!n) {
+                e = ship();
+                continue;
+            }
+            e = frm.encode_raw(span{p, n});
+            p   += n;
+            pos += n;
+            len -= n;
+        }
+        return e;
+    };
+    auto put = [&](const chunk& cnk) -> err {
+        switch (cnk.type)
+        {
+        case type_rep: return frm.encode_rep(cnk.rep, cnk.size);
+        case type_arr: return frm.encode_arr(span{cnk.arr.data, cnk.size}, cnk.arr.reps);
+        case type_off: return frm.encode_off(cnk.off, cnk.size);
+        case type_cpy: return frm.encode_cpy(cnk.cpy, cnk.size);
+        default: return err_invalid_size;
+        }
+    };
+
+    begin();
+
+    for (pointer p = s.data(), end = p + s.size(); p < end;) {
+
+        auto [cnk, e, next] = decode(p, end, s.ext);
+        if (e != err_ok)
+            return e;
+        p = next;
+
+        if (cnk.type == type_raw) {
+            if ((e = raw(cnk.raw, cnk.size)) != err_ok)
+                return e;
+            continue;
+        }
+        const size_t len = cnk.type == type_arr ? cnk.size * cnk.arr.reps : cnk.size;
+
+        if ((e = put(cnk)) == err_no_memory) {
+            if ((e = ship()) != err_ok)
+                return e;
+            e = put(cnk);
+        }
+        if (e == err_no_memory && cnk.type == type_arr) {
+            e = err_ok;
+            for (size_t i = 0; e == err_ok && i < cnk.arr.reps; ++i)
+                e = raw(cnk.arr.data, cnk.size);
+            if (e != err_ok)
+                return e;
+            continue;
+        }
+        if (e != err_ok)
+            return e;
+        pos += len;
+    }
+    err e = ship();
+
+    if (stats)
+        *stats = st;
+    return e;
+}
+
+/**
+ * @brief Apply single frame produced by dfu::packetize(). Device is
+ * repositioned to frame address first, so frames may be applied again
+ * or in any order, as long as CPY sources are already in place.
+ * 
+ * @param frame Frame with address and chunks
+ * @param dev Output device
+ * @param ext Decoder extension of packetized sequence
+ * @return First error encountered or err_ok
+ */
+template<seekable D>
+constexpr err apply_frame(span frame, D& dev, extension ext = ext_none)
+{
+    if (frame.size() < pkt::head_len)
+        return err_out_of_bounds;
+
+    size_t addr = 0;
+    for (size_t i = 0; i < pkt::head_len; ++i)
+        addr |= size_t(frame[i]) << (i * 8);
+
+    err e = dev.seek(addr);
+    if (e == err_ok)
+        e = applier<D>{dev, addr}.apply(seq{frame.data() + pkt::head_len, frame.size() - pkt::head_len, ext});
+    return e;
+}
+
+}
+
+#endif
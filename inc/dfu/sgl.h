@@ -0,0 +1,263 @@
+#ifndef DFU_SGL_H
+#define DFU_SGL_H
+
+#include "dfu/dec.h"
+#include <algorithm>
+#include <memory>
+#include <vector>
+
+#if __has_include(<sys/uio.h>)
+#include <sys/uio.h>
+#include <cerrno>
+#include <climits>
+#include <unistd.h>
+#define DFU_SGL_IOVEC 1
+#else
+#define DFU_SGL_IOVEC 0
+#endif
+
+namespace dfu {
+
+/**
+ * @brief Reference to a piece of reconstructed image. Same layout as
+ * POSIX iovec, so list of segments is passed to writev() as is.
+ * 
+ */
+struct segment {
+    pointer data;
+    size_t size;
+};
+
+/**
+ * @brief Scatter-gather list of reconstructed image. Segments point into
+ * patch, old image or small internal arena, which holds only materialized
+ * REP, short ARR patterns and one block of short-period CPY. Patch and old image must
+ * outlive the list.
+ * 
+ */
+struct sglist {
+    static constexpr size_t block = 4096;
+#if defined(IOV_MAX)
+    static constexpr size_t iov_max = IOV_MAX;
+#else
+    static constexpr size_t iov_max = 16; // NOTE: Least one POSIX allows
+#endif
+
+    const std::vector<segment>& segments() const    { return segs; }
+    size_t size() const                             { return total; }
+    size_t arena() const                            { return used; }
+#if DFU_SGL_IOVEC
+    const iovec* iov() const                        { return reinterpret_cast<const iovec*>(segs.data()); }
+#endif
+#if DFU_SGL_IOVEC
+    /**
+     * @brief Write whole image to file descriptor. Single writev() takes
+     * at most iov_max segments and may write only part of them, so list
+     * goes out in batches, resuming right after last byte written.
+     * 
+     * @return err_no_memory if write fails, otherwise err_ok
+     */
+    err write(int fd) const
+    {
+        for (size_t i = 0, k = 0; i < segs.size();) {
+            ssize_t n;
+            if (k) // NOTE: Rest of partially written segment
+                n = ::write(fd, segs[i].data + k, segs[i].size - k);
+            else
+                n = ::writev(fd, iov() + i, int(std::min(segs.size() - i, iov_max)));
+            if (n < 0 && errno == EINTR)
+                continue;
+            if (n <= 0)
+                return err_no_memory;
+            for (k += n; i < segs.size() && k >= segs[i].size; ++i)
+                k -= segs[i].size;
+        }
+        return err_ok;
+    }
+#endif
+    void clear()
+    {
+        segs.clear();
+        starts.clear();
+        blocks.clear();
+        std::ranges::fill(reps, nullptr);
+        total = used = 0;
+    }
+
+    /**
+     * @brief Append reference to existing memory, gluing it to previous
+     * segment when contiguous.
+     * 
+     */
+    void add(pointer p, size_t len)
+    {
+        if (!len)
+            return;
+        if (!segs.empty() && segs.back().data + segs.back().size == p) {
+            segs.back().size += len;
+        } else {
+            segs.push_back({p, len});
+            starts.push_back(total);
+        }
+        total += len;
+    }
+
+    /**
+     * @brief Get block of repeated byte, materialized once per byte value.
+     * 
+     */
+    pointer rep(byte val)
+    {
+        if (!reps[val]) {
+            reps[val] = alloc(block);
+            std::fill_n(reps[val], block, val);
+        }
+        return reps[val];
+    }
+
+    /**
+     * @brief Allocate arena memory which stays valid till clear().
+     * 
+     */
+    byte* alloc(size_t len)
+    {
+        blocks.push_back(std::make_unique<byte[]>(len));
+        used += len;
+        return blocks.back().get();
+    }
+
+    /**
+     * @brief Copy out already reconstructed range, must be in bounds.
+     * 
+     */
+    void read(size_t addr, byte* dst, size_t len) const
+    {
+        size_t i = std::upper_bound(starts.begin(), starts.end(), addr) - starts.begin() - 1;
+        for (size_t n; len; ++i, addr += n, dst += n, len -= n) {
+            size_t k = addr - starts[i];
+            n = std::min(len, segs[i].size - k);
+            std::copy_n(segs[i].data + k, n, dst);
+        }
+    }
+
+    /**
+     * @brief Append references to already reconstructed range.
+     * 
+     */
+    err again(size_t addr, size_t len)
+    {
+        if (addr > total || len > total - addr)
+            return err_out_of_bounds;
+        size_t i = std::upper_bound(starts.begin(), starts.end(), addr) - starts.begin() - 1;
+        for (size_t n; len; ++i, addr += n, len -= n) {
+            size_t k = addr - starts[i];
+            n = std::min(len, segs[i].size - k);
+            add(segs[i].data + k, n);
+        }
+        return err_ok;
+    }
+private:
+    std::vector<segment> segs;
+    std::vector<size_t> starts;
+    std::vector<std::unique_ptr<byte[]>> blocks;
+    byte* reps[256]{};
+    size_t total = 0;
+    size_t used = 0;
+};
+
+#if DFU_SGL_IOVEC
+static_assert(sizeof(segment) == sizeof(iovec));
+static_assert(offsetof(segment, data) == offsetof(iovec, iov_base));
+static_assert(offsetof(segment, size) == offsetof(iovec, iov_len));
+#endif
+
+/**
+ * @brief Apply encoded sequence without copying bulk data. RAW becomes
+ * reference into patch, OFF into old image, CPY into earlier segments,
+ * while REP and short patterns are materialized into arena of the list.
+ * Overlapping CPY with period under block size materializes at most one
+ * block of whole periods, longer periods are referenced period by period,
+ * so any chunk adds at most about size / sglist::block segments times
+ * number of segments its source period spans.
+ * 
+ * @param s Encoded sequence, must stay mapped while list is used
+ * @param old Old image, must stay mapped while list is used
+ * @param out Output list, appended to
+ * @return First error encountered or err_ok
+ */
+inline err gather(seq s, span old, sglist& out)
+{
+    for (pointer p = s.data(), end = p + s.size(); p < end;) {
+
+        auto [cnk, e, next] = decode(p, end, s.ext);
+        if (e != err_ok)
+            return e;
+        p = next;
+
+        const size_t pos = out.size();
+
+        switch (cnk.type)
+        {
+        case type_raw:
+            out.add(cnk.raw, cnk.size);
+        break;
+        case type_rep: {
+            pointer blk = out.rep(cnk.rep);
+            for (size_t done = 0, n; done < cnk.size; done += n) {
+                n = std::min(cnk.size - done, sglist::block);
+                out.add(blk, n);
+            }
+        }
+        break;
+        case type_arr:
+            if (cnk.size >= 64) {
+                for (size_t i = 0; i < cnk.arr.reps; ++i)
+                    out.add(cnk.arr.data, cnk.size);
+            } else {
+                const size_t len = cnk.size * cnk.arr.reps;
+                byte* dst = out.alloc(len);
+                for (size_t i = 0; i < cnk.arr.reps; ++i)
+                    std::copy_n(cnk.arr.data, cnk.size, dst + i * cnk.size);
+                out.add(dst, len);
+            }
+        break;
+        case type_off: {
+            if (cnk.off < 0 && size_t(-int64_t(cnk.off)) > pos)
+                return err_out_of_bounds;
+            const size_t addr = pos + cnk.off;
+            if (addr > old.size() || cnk.size > old.size() - addr)
+                return err_out_of_bounds;
+            out.add(old.data() + addr, cnk.size);
+        }
+        break;
+        case type_cpy:
+            if (!cnk.cpy || cnk.cpy > pos)
+                return err_out_of_bounds;
+            if (cnk.cpy < sglist::block && cnk.size > cnk.cpy) { // NOTE: Short period would produce too many tiny segments
+                const size_t len = std::min<size_t>(cnk.size, sglist::block / cnk.cpy * cnk.cpy);
+                byte* dst = out.alloc(len);
+                out.read(pos - cnk.cpy, dst, cnk.cpy);
+                for (size_t i = cnk.cpy; i < len; ++i)
+                    dst[i] = dst[i - cnk.cpy];
+                for (size_t done = 0, n; done < cnk.size; done += n) {
+                    n = std::min(cnk.size - done, len); // NOTE: Whole periods, so every block starts in phase
+                    out.add(dst, n);
+                }
+                break;
+            }
+            for (size_t done = 0, n; done < cnk.size; done += n) {
+                n = std::min<size_t>(cnk.size - done, cnk.cpy);
+                if ((e = out.again(pos + done - cnk.cpy, n)) != err_ok)
+                    return e;
+            }
+        break;
+        default:
+            return err_invalid_size;
+        }
+    }
+    return err_ok;
+}
+
+}
+
+#endif
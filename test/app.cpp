@@ -0,0 +1,113 @@
+#include <gtest/gtest.h>
+#include "dfu/app.h"
+#include "dfu/enc.h"
+
+using namespace dfu;
+
+class Apply : public ::testing::Test {
+protected:
+    err run(seq s)
+    {
+        memory dev{old, out};
+        err e = apply(seq{s.data(), s.size(), ext_cpy}, dev);
+        len = dev.size();
+        return e;
+    }
+    void check(std::initializer_list<byte> exp)
+    {
+        ASSERT_EQ(len, exp.size());
+        for (size_t i = 0; auto it : exp)
+            ASSERT_EQ(out[i++], it) << "at index " << i;
+    }
+protected:
+    const byte old[8] = {0x10, 0x11, 0x12, 0x13, 0x14, 0x15, 0x16, 0x17};
+    byte out[64] = {};
+    size_t len = 0;
+    dfu::codec<64> codec;
+};
+
+TEST_F(Apply, Mixed)
+{
+    codec.encode_raw({0x55, 0x66});
+    codec.encode_rep(0x42, 3);
+    codec.encode_arr({0x01, 0x02}, 2);
+    codec.encode_off(-7, 3);
+    codec.encode_cpy(12, 2);
+
+    ASSERT_EQ(run(codec), err_ok);
+
+    check({
+        0x55, 0x66,
+        0x42, 0x42, 0x42,
+        0x01, 0x02, 0x01, 0x02,
+        0x12, 0x13, 0x14,
+        0x55, 0x66,
+    });
+}
+
+TEST_F(Apply, OverlappingCopy)
+{
+    codec.encode_raw({0xaa, 0xbb, 0xcc});
+    codec.encode_cpy(3, 7);
+    codec.encode_cpy(1, 2);
+
+    ASSERT_EQ(run(codec), err_ok);
+
+    check({0xaa, 0xbb, 0xcc, 0xaa, 0xbb, 0xcc, 0xaa, 0xbb, 0xcc, 0xaa, 0xaa, 0xaa});
+}
+
+TEST_F(Apply, PaddedOffset)
+{
+    const byte test[] = {
+        0x03, 0x09, 0x00, // OLD[1] offs +2, CPY dist 2 with extension
+        0x03, 0xfd, 0xff, // OLD[1] offs -1, invalid with extension
+    };
+    memory dev{old, out};
+    ASSERT_EQ(apply(seq{test}, dev), err_ok);
+    ASSERT_EQ(dev.size(), 2);
+    ASSERT_EQ(out[0], 0x12);
+    ASSERT_EQ(out[1], 0x10);
+
+    memory ext{old, out};
+    ASSERT_EQ(apply(seq{test, sizeof(test), ext_cpy}, ext), err_out_of_bounds);
+}
+
+TEST_F(Apply, Constexpr)
+{
+    static constexpr auto res = []()
+    {
+        const byte old[4] = {0x01, 0x02, 0x03, 0x04};
+        byte out[8] = {};
+        dfu::codec<16> codec;
+        codec.encode_off(1, 3);
+        codec.encode_cpy(2, 4);
+        memory dev{old, out};
+        apply(seq{codec.data(), codec.size(), ext_cpy}, dev);
+        return out[0] + out[2] + out[5] + out[6];
+    }();
+    static_assert(res == 0x02 + 0x04 + 0x03 + 0x04);
+}
+
+TEST_F(Apply, Failures)
+{
+    codec.encode_off(-1, 1);
+    ASSERT_EQ(run(codec), err_out_of_bounds);
+    codec.clear();
+
+    codec.encode_off(4, 5);
+    ASSERT_EQ(run(codec), err_out_of_bounds);
+    codec.clear();
+
+    codec.encode_raw({0x00});
+    codec.encode_cpy(2, 1);
+    ASSERT_EQ(run(codec), err_out_of_bounds);
+    codec.clear();
+
+    codec.encode_rep(0x00, 65);
+    ASSERT_EQ(run(codec), err_no_memory);
+    codec.clear();
+
+    codec.encode_raw({0x00, 0x11});
+    codec.resize(codec.size() - 1);
+    ASSERT_EQ(run(codec), err_out_of_bounds);
+}
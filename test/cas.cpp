@@ -0,0 +1,162 @@
+#include <gtest/gtest.h>
+#include "dfu/cas.h"
+#include <fstream>
+#include <random>
+#include <thread>
+
+using namespace dfu;
+
+class Cache : public ::testing::Test {
+protected:
+    void SetUp() override
+    {
+        dir = std::filesystem::temp_directory_path() / ("dfu-cas-" + std::to_string(::getpid()) + "-" + ::testing::UnitTest::GetInstance()->current_test_info()->name());
+        std::filesystem::remove_all(dir);
+
+        std::mt19937 rng{1};
+        old.resize(4096);
+        for (auto& it : old)
+            it = rng();
+        img = old;
+        for (size_t i = 0; i < 16; ++i)
+            img[rng() % img.size()] = rng();
+    }
+    void TearDown() override
+    {
+        std::filesystem::remove_all(dir);
+    }
+    std::vector<byte> run(seq s) const
+    {
+        std::vector<byte> res(img.size());
+        memory dev{old, res};
+        EXPECT_EQ(apply(s, dev), err_ok);
+        return res;
+    }
+    static cache_key key(byte val)
+    {
+        cache_key res{};
+        res[0] = val;
+        return res;
+    }
+protected:
+    std::filesystem::path dir;
+    std::vector<byte> old;
+    std::vector<byte> img;
+};
+
+TEST_F(Cache, Key)
+{
+    diff_params prm;
+    const auto k = cache_key_of(old, img, prm);
+
+    EXPECT_EQ(cache_key_of(old, img, prm), k);
+    EXPECT_NE(cache_key_of(img, old, prm), k);
+    prm.max_chain = 64;
+    EXPECT_NE(cache_key_of(old, img, prm), k);
+    prm = {};
+    prm.self = true;
+    EXPECT_NE(cache_key_of(old, img, prm), k);
+}
+
+TEST_F(Cache, HitMiss)
+{
+    mapping m;
+    {
+        cache c{dir, 1 << 20};
+        ASSERT_EQ(c.get(old, img, m), err_ok);
+        EXPECT_EQ(c.stats().misses, 1);
+        EXPECT_EQ(c.stats().hits, 0);
+        EXPECT_EQ(run(m.body()), img);
+    }
+    cache c{dir, 1 << 20};  // NOTE: Another worker sharing directory
+    mapping n;
+    ASSERT_EQ(c.get(old, img, n), err_ok);
+    EXPECT_EQ(c.stats().hits, 1);
+    EXPECT_EQ(c.stats().misses, 0);
+    EXPECT_TRUE(std::equal(m.body().data(), m.body().data() + m.body().size(), n.body().data(), n.body().data() + n.body().size()));
+
+    diff_params prm;
+    prm.self = true;
+    ASSERT_EQ(c.get(old, img, n, prm), err_ok);
+    EXPECT_EQ(c.stats().misses, 1);
+    EXPECT_EQ(run(n.body(ext_cpy)), img);
+}
+
+TEST_F(Cache, Eviction)
+{
+    cache c{dir, 250};
+
+    const std::vector<byte> data(100, 0x42);
+
+    ASSERT_EQ(c.store(key(1), data), err_ok);
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    ASSERT_EQ(c.store(key(2), data), err_ok);
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    auto m = c.find(key(1));    // NOTE: Now 2 is least recently used
+    ASSERT_TRUE(m);
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    ASSERT_EQ(c.store(key(3), data), err_ok);
+
+    EXPECT_EQ(c.stats().evicted, 1);
+    EXPECT_EQ(c.usage(), 200);
+    EXPECT_TRUE(c.find(key(1)));
+    EXPECT_FALSE(c.find(key(2)));
+    EXPECT_TRUE(c.find(key(3)));
+    EXPECT_EQ(m.body().size(), 100);
+    EXPECT_EQ(m.body()[99], 0x42);
+
+    ASSERT_EQ(c.store(key(4), std::vector<byte>(1000)), err_ok); // NOTE: Oversized entry evicts all others but itself
+    EXPECT_EQ(c.usage(), 1000);
+    EXPECT_TRUE(c.find(key(4)));
+}
+
+TEST_F(Cache, Publish)
+{
+    cache c{dir, 1 << 20};
+
+    std::filesystem::create_directories(dir);
+    std::ofstream{dir / (cas::hex(key(5)) + ".tmp.1.0")} << "partial";
+
+    EXPECT_FALSE(c.find(key(5)));
+    EXPECT_EQ(c.usage(), 0);
+
+    ASSERT_EQ(c.store(key(5), {}), err_ok);
+    auto m = c.find(key(5));
+    ASSERT_TRUE(m);
+    EXPECT_EQ(m.body().size(), 0);
+
+    size_t files = 0;
+    for ([[maybe_unused]] auto& it : std::filesystem::directory_iterator{dir})
+        ++files;
+    EXPECT_EQ(files, 2);
+}
+
+TEST_F(Cache, Stale)
+{
+    cache c{dir, 1 << 20};
+
+    const auto dead  = dir / (cas::hex(key(6)) + ".tmp.1.0");
+    const auto alive = dir / (cas::hex(key(7)) + ".tmp.2.0");
+    std::ofstream{dead} << "crashed";
+    std::ofstream{alive} << "pending";
+    std::filesystem::last_write_time(dead, std::filesystem::file_time_type::clock::now() - cache::grace - std::chrono::minutes(1));
+
+    ASSERT_EQ(c.store(key(8), std::vector<byte>(10)), err_ok);
+
+    EXPECT_EQ(c.stats().stale, 1);
+    EXPECT_FALSE(std::filesystem::exists(dead));
+    EXPECT_TRUE(std::filesystem::exists(alive));
+    EXPECT_TRUE(c.find(key(8)));
+}
+
+TEST_F(Cache, Failures)
+{
+    cache c{dir, 1 << 20};
+    std::filesystem::remove_all(dir);
+    EXPECT_EQ(c.store(key(1), {}), err_no_memory);
+    EXPECT_FALSE(c.find(key(1)));
+
+    mapping m;
+    EXPECT_EQ(c.get(old, img, m), err_no_memory);
+    EXPECT_FALSE(m);
+}
@@ -0,0 +1,166 @@
+#include <gtest/gtest.h>
+#include "dfu/cmp.h"
+#include "dfu/dif.h"
+#include "dfu/app.h"
+#include <random>
+
+using namespace dfu;
+
+class Compose : public ::testing::Test {
+protected:
+    static std::vector<byte> patch(const std::vector<byte>& from, const std::vector<byte>& to)
+    {
+        std::vector<byte> buf(65536);
+        size_t len = 0;
+        EXPECT_EQ(diff(from, to, ref{buf, len}), err_ok);
+        buf.resize(len);
+        return buf;
+    }
+    static std::vector<byte> run(const std::vector<byte>& from, seq s, size_t size)
+    {
+        std::vector<byte> res(size);
+        memory dev{from, res};
+        EXPECT_EQ(apply(seq{s.data(), s.size(), ext_cpy}, dev), err_ok);
+        EXPECT_EQ(dev.size(), size);
+        return res;
+    }
+    void compose(seq ab, seq bc)
+    {
+        len = 0;
+        ASSERT_EQ(dfu::compose(seq{ab.data(), ab.size(), ext_cpy}, seq{bc.data(), bc.size(), ext_cpy}, ref{buf, len}), err_ok);
+    }
+protected:
+    std::vector<byte> buf = std::vector<byte>(65536);
+    size_t len = 0;
+};
+
+TEST_F(Compose, Chunks)
+{
+    const std::vector<byte> a = {0x10, 0x11, 0x12, 0x13, 0x14, 0x15, 0x16, 0x17};
+
+    dfu::codec<64> ab;
+    ab.encode_off(4, 4);            // B[0..4)   = 14 15 16 17
+    ab.encode_raw({0xaa, 0xbb});    // B[4..6)   = aa bb
+    ab.encode_arr({1, 2, 3}, 3);    // B[6..15)  = 01 02 03 x3
+    ab.encode_rep(0x42, 5);         // B[15..20) = 42 x5
+    ab.encode_cpy(3, 7);            // B[20..27) = 42 42 42 42 42 42 42
+    ab.encode_cpy(23, 4);           // B[27..31) = 17 aa bb 01
+
+    dfu::codec<64> bc;
+    bc.encode_off(7, 24);           // C[0..24)   = B[7..31)
+    bc.encode_raw({0x99});          // C[24]
+    bc.encode_off(-25, 4);          // C[25..29) = B[0..4)
+    bc.encode_cpy(29, 3);           // C[29..32) = C[0..3)
+
+    compose(ab, bc);
+
+    auto b = run(a, ab, 31);
+    auto c = run(b, bc, 32);
+
+    ASSERT_EQ(run(a, seq{buf.data(), len}, 32), c);
+
+    for (auto it : seq{buf.data(), len, ext_cpy})
+        ASSERT_NE(it.type, type_invalid);
+}
+
+TEST_F(Compose, Images)
+{
+    std::mt19937 rng{1};
+    std::vector<byte> a(16384);
+    for (auto& it : a)
+        it = rng();
+
+    auto b = a;
+    b.erase(b.begin() + 1000, b.begin() + 1200);
+    b.insert(b.begin() + 5000, 300, 0xff);
+    b.insert(b.begin() + 9000, a.begin() + 20, a.begin() + 700);
+    for (int i = 0; i < 16; ++i)
+        b[rng() % b.size()] = rng();
+
+    auto c = b;
+    c.erase(c.begin() + 3000, c.begin() + 3100);
+    c.insert(c.begin() + 12000, b.begin() + 9000, b.begin() + 9400);
+    for (int i = 0; i < 16; ++i)
+        c[rng() % c.size()] = rng();
+
+    auto ab = patch(a, b);
+    auto bc = patch(b, c);
+
+    compose(ab, bc);
+
+    ASSERT_EQ(run(a, seq{buf.data(), len}, c.size()), c);
+    ASSERT_LT(len, ab.size() + bc.size());
+}
+
+TEST_F(Compose, LongCopy)
+{
+    std::mt19937 rng{2};
+    std::vector<byte> a(1000);
+    for (auto& it : a)
+        it = rng();
+
+    const size_t tail = 400000;
+    const size_t total = a.size() + 3 + tail;
+
+    dfu::codec<64> ab;
+    ab.encode_off(0, a.size());
+    ab.encode_raw({0x01, 0x02, 0x03});
+    ab.encode_cpy(3, tail);             // NOTE: Long small-period copy
+
+    dfu::codec<64> bc;
+    bc.encode_off(0, total - 1000);
+    bc.encode_raw({0xee});
+    bc.encode_off(0, 999);              // NOTE: Deep inside tail of the copy
+
+    compose(ab, bc);
+
+    auto b = run(a, ab, total);
+    auto c = run(b, bc, total);
+
+    ASSERT_EQ(run(a, seq{buf.data(), len}, total), c);
+    ASSERT_LT(len, 64);
+}
+
+TEST_F(Compose, ChainedCopy)
+{
+    const size_t n = 100000;
+    const size_t total = 2 + 2 * n;
+
+    std::vector<byte> ab(8 * n);
+    size_t ab_len = 0;
+    ref enc{ab, ab_len};
+    enc.encode_raw({0x5a, 0x11});
+    for (size_t i = 0; i < n; ++i)
+        enc.encode_cpy(2, 2);           // NOTE: Every chunk copies the one before it
+    ab.resize(ab_len);
+
+    dfu::codec<16> bc;
+    bc.encode_off(2 * n, 2);            // NOTE: Last period, at the end of the chain
+
+    compose(ab, bc);
+
+    auto b = run({}, ab, total);
+    auto c = run(b, bc, 2);
+
+    ASSERT_EQ(run({}, seq{buf.data(), len}, 2), c);
+    ASSERT_EQ(c, std::vector<byte>({0x5a, 0x11}));
+}
+
+TEST_F(Compose, Failures)
+{
+    dfu::codec<16> ab;
+    dfu::codec<16> bc;
+
+    ab.encode_rep(0x00, 4);
+    bc.encode_off(1, 4);
+    ASSERT_EQ(dfu::compose(ab, bc, ref{buf, len}), err_out_of_bounds);
+
+    bc.clear();
+    bc.encode_off(-1, 1);
+    ASSERT_EQ(dfu::compose(ab, bc, ref{buf, len}), err_out_of_bounds);
+
+    bc.clear();
+    bc.encode_raw({0x00, 0x11});
+    bc.resize(bc.size() - 1);
+    ASSERT_EQ(dfu::compose(ab, bc, ref{buf, len}), err_out_of_bounds);
+}
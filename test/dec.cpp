@@ -12,7 +12,7 @@ protected:
     }
     void check(pointer exp_ptr, chunk_type exp_type, size_t exp_size)
     {
-        std::tie(c, e, ptr) = decode(ptr, end);
+        std::tie(c, e, ptr) = decode(ptr, end, ext);
         ASSERT_EQ(e, err_ok);
         ASSERT_EQ(ptr, exp_ptr);
         ASSERT_EQ(c.type, exp_type);
@@ -39,11 +39,17 @@ protected:
         check(exp_ptr, type_off, exp_size);
         ASSERT_EQ(c.off, exp_off);
     }
+    void check_cpy(pointer exp_ptr, size_t exp_size, uint32_t exp_cpy) 
+    {
+        check(exp_ptr, type_cpy, exp_size);
+        ASSERT_EQ(c.cpy, exp_cpy);
+    }
 protected:
     err e;
     chunk c;
     pointer ptr;
     pointer end;
+    extension ext = ext_none;
 };
 
 TEST_F(Decode, DefaultChunk)
@@ -153,6 +159,41 @@ TEST_F(Decode, OldOffset)
     check_off(test + 42, 268435456, -536870912);
 }
 
+TEST_F(Decode, NewCopy)
+{
+    const byte test[] = {
+        0x33, 0x05, 0x00, // CPY[4] dist 1
+        0xf3, 0x7d, 0x00, // CPY[16] dist 31
+        0x03, 0x82, 0x00, 0x00, // CPY[1] dist 32
+        0x07, 0x01, 0xff, 0xff, 0x7f, 0x00, // CPY[17] dist 2097151
+    };
+    ptr = test;
+    end = test + sizeof(test);
+    ext = ext_cpy;
+
+    check_cpy(test + 3, 4, 1);
+    check_cpy(test + 6, 16, 31);
+    check_cpy(test + 10, 1, 32);
+    check_cpy(test + 16, 17, 2097151);
+}
+
+TEST_F(Decode, PaddedOffset)
+{
+    const byte test[] = {
+        0x33, 0x05, 0x00, // OLD[4] offs +1
+        0x03, 0xfd, 0xff, // OLD[1] offs -1
+        0x03, 0x09, 0x00, // OLD[1] offs +2
+        0x03, 0x01, 0x00, // OLD[1] offs 0
+    };
+    ptr = test;
+    end = test + sizeof(test);
+
+    check_off(test + 3, 4, 1);
+    check_off(test + 6, 1, -1);
+    check_off(test + 9, 1, 2);
+    check_off(test + 12, 1, 0);
+}
+
 TEST_F(Decode, Mixed)
 {
     const byte test[] = {
@@ -195,6 +236,81 @@ TEST_F(Decode, Constexpr)
     static_assert(6 == cnt);
 }
 
+TEST_F(Decode, Visit)
+{
+    const byte test[] = {
+        0x20, 0x55, 0x66, 0x77,         // RAW[3] {55 66 77}
+        0x35, 0x06, 0x42,               // REP[100] byte 0x42
+        0x22, 0x01, 0x01, 0x02, 0x03,   // ARR[3] reps 2 {01 02 03}
+        0xf7, 0x3f, 0x05, 0x80,         // OLD[1024] offs -8191 
+        0x33, 0x05, 0x00,               // CPY[4] dist 1
+    };
+    std::string log;
+
+    auto res = visit(seq{test, sizeof(test), ext_cpy},
+        [&](pointer data, size_t size) { 
+            ASSERT_EQ(data, test + 1);
+            ASSERT_EQ(size, 3);
+            log += "raw "; 
+        },
+        [&](byte val, size_t size) { 
+            ASSERT_EQ(val, 0x42);
+            ASSERT_EQ(size, 100);
+            log += "rep "; 
+        },
+        [&](pointer data, size_t size, size_t reps) { 
+            ASSERT_EQ(data, test + 9);
+            ASSERT_EQ(size, 3);
+            ASSERT_EQ(reps, 2);
+            log += "arr "; 
+        },
+        [&](int32_t off, size_t size) { 
+            ASSERT_EQ(off, -8191);
+            ASSERT_EQ(size, 1024);
+            log += "off "; 
+        },
+        [&](uint32_t dist, size_t size) { 
+            ASSERT_EQ(dist, 1);
+            ASSERT_EQ(size, 4);
+            log += "cpy"; 
+        });
+
+    ASSERT_EQ(res, err_ok);
+    ASSERT_EQ(log, "raw rep arr off cpy");
+
+    int n = 0;
+    auto count = [&](auto...) { return ++n == 2 ? err_no_memory : err_ok; };
+
+    ASSERT_EQ(visit(seq{test, sizeof(test), ext_cpy}, count, count, count, count, count), err_no_memory);
+    ASSERT_EQ(n, 2);
+    ASSERT_EQ(visit(seq{test, sizeof(test) - 1, ext_cpy}, [](auto...) {}, [](auto...) {}, [](auto...) {}, [](auto...) {}, [](auto...) {}), err_out_of_bounds);
+
+    ptr = end = nullptr;
+}
+
+TEST_F(Decode, Validate)
+{
+    static constexpr byte good[] = {
+        0x20, 0x55, 0x66, 0x77,         // RAW[3] {55 66 77}
+        0x35, 0x06, 0x42,               // REP[100] byte 0x42
+        0x33, 0x05, 0x00,               // CPY[4] dist 1
+    };
+    static constexpr byte truncated[] = {
+        0x20, 0x55, 0x66, 0x77,         // RAW[3] {55 66 77}
+        0x35, 0x06,                     // REP[100] without byte
+    };
+    static constexpr byte bad_copy[] = {
+        0x03, 0x01, 0x00,               // CPY with zero distance
+    };
+    static_assert(validate(good) == err_ok);
+    static_assert(validate(seq{}) == err_ok);
+    static_assert(validate(truncated) == err_out_of_bounds);
+    static_assert(validate(seq{bad_copy, sizeof(bad_copy), ext_cpy}) == err_invalid_size);
+    static_assert(validate(bad_copy) == err_ok); // NOTE: Padded OFF without extension
+
+    ptr = end = nullptr;
+}
+
 TEST_F(Decode, Failures)
 {
     std::array<byte, 1> test_1 = { 0x00 };
@@ -205,6 +321,8 @@ TEST_F(Decode, Failures)
     std::array<byte, 2> test_6 = { 0x02, 0x00 };
     std::array<byte, 1> test_7 = { 0xf3 };
     std::array<byte, 4> test_8 = { 0xfd, 0xff, 0xff, 0xff };
+    std::array<byte, 3> test_9 = { 0x03, 0x01, 0x00 };
+    std::array<byte, 3> test_10 = { 0x03, 0xfd, 0xff };
 
     std::tie(c, e, ptr) = decode(test_1.begin(), test_1.begin());
 
@@ -254,5 +372,17 @@ TEST_F(Decode, Failures)
     ASSERT_EQ(ptr, test_8.begin() + 1);
     ASSERT_EQ(c.type, type_invalid);
 
+    std::tie(c, e, ptr) = decode(test_9.begin(), test_9.end(), ext_cpy);
+
+    ASSERT_EQ(e, err_invalid_size);
+    ASSERT_EQ(ptr, test_9.end());
+    ASSERT_EQ(c.type, type_invalid);
+
+    std::tie(c, e, ptr) = decode(test_10.begin(), test_10.end(), ext_cpy);
+
+    ASSERT_EQ(e, err_invalid_size);
+    ASSERT_EQ(ptr, test_10.end());
+    ASSERT_EQ(c.type, type_invalid);
+
     ptr = end = nullptr;
 }
\ No newline at end of file
@@ -0,0 +1,176 @@
+#include <gtest/gtest.h>
+#include "dfu/dif.h"
+#include "dfu/app.h"
+#include <numeric>
+#include <random>
+
+using namespace dfu;
+
+class Diff : public ::testing::Test {
+protected:
+    void SetUp() override
+    {
+        std::mt19937 rng{42};
+        old_img.resize(8192);
+        for (auto& it : old_img)
+            it = rng();
+    }
+    void roundtrip(const diff_params& prm = {})
+    {
+        len = 0;
+        ext = prm.self ? ext_cpy : ext_none;
+        ASSERT_EQ(diff(old_img, new_img, patch, prm), err_ok);
+        std::vector<byte> res(new_img.size());
+        memory dev{old_img, res};
+        ASSERT_EQ(apply(seq{patch.data(), len, ext}, dev), err_ok);
+        ASSERT_EQ(dev.size(), new_img.size());
+        ASSERT_EQ(res, new_img);
+    }
+    size_t count(chunk_type type) const
+    {
+        size_t n = 0;
+        for (auto it : seq{patch.data(), len, ext})
+            n += it.type == type;
+        return n;
+    }
+protected:
+    std::vector<byte> old_img;
+    std::vector<byte> new_img;
+    std::vector<byte> buf = std::vector<byte>(65536);
+    size_t len = 0;
+    ref patch{buf, len};
+    extension ext = ext_none;
+};
+
+TEST_F(Diff, Identical)
+{
+    new_img = old_img;
+    roundtrip();
+    ASSERT_EQ(count(type_off), 1);
+    ASSERT_LT(len, 8);
+}
+
+TEST_F(Diff, Edited)
+{
+    new_img = old_img;
+    new_img.erase(new_img.begin() + 100, new_img.begin() + 300);
+    new_img.insert(new_img.begin() + 4000, {0xde, 0xad, 0xbe, 0xef, 0x01});
+    new_img.insert(new_img.end(), 500, 0xff);
+    new_img[6000] ^= 0x55;
+    roundtrip();
+    ASSERT_GE(count(type_off), 3);
+    ASSERT_EQ(count(type_rep), 1);
+    ASSERT_LT(len, 64);
+}
+
+TEST_F(Diff, SelfReference)
+{
+    std::mt19937 rng{7};
+    std::vector<byte> fresh(1000);
+    for (auto& it : fresh)
+        it = rng();
+
+    new_img = old_img;
+    new_img.insert(new_img.begin() + 2000, fresh.begin(), fresh.end());
+    new_img.insert(new_img.begin() + 5000, fresh.begin(), fresh.end());
+    roundtrip({.self = true});
+    ASSERT_EQ(count(type_cpy), 1);
+    ASSERT_LT(len, 1000 + 64);
+
+    roundtrip({.self = false});
+    ASSERT_EQ(count(type_cpy), 0);
+    ASSERT_GT(len, 2000);
+}
+
+TEST_F(Diff, Empty)
+{
+    roundtrip();
+    ASSERT_EQ(len, 0);
+
+    new_img = {0x01, 0x02};
+    old_img.clear();
+    roundtrip();
+    ASSERT_EQ(count(type_raw), 1);
+}
+
+TEST_F(Diff, NoMemory)
+{
+    new_img.resize(100);
+    std::iota(new_img.begin(), new_img.end(), 0);
+    std::vector<byte> small(10);
+    size_t small_len = 0;
+    ASSERT_EQ(diff(old_img, new_img, ref{small, small_len}), err_no_memory);
+}
+
+TEST_F(Diff, Batch)
+{
+    std::mt19937 rng{3};
+    std::vector<std::vector<byte>> bases(4, old_img);
+    for (size_t i = 0; i < bases.size(); ++i) {
+        bases[i].erase(bases[i].begin() + 500 * i, bases[i].begin() + 500 * i + 100);
+        for (int j = 0; j < 8; ++j)
+            bases[i][rng() % bases[i].size()] = rng();
+    }
+    new_img = old_img;
+    new_img.insert(new_img.begin() + 3000, 64, 0x00);
+
+    std::vector<span> spans(bases.begin(), bases.end());
+    std::vector<std::vector<byte>> bufs(bases.size(), std::vector<byte>(65536));
+    std::vector<size_t> lens(bases.size());
+    std::vector<ref> outs;
+    for (size_t i = 0; i < bases.size(); ++i)
+        outs.emplace_back(bufs[i], lens[i]);
+
+    batch_stats stats;
+    ASSERT_EQ(diff_batch(spans, new_img, outs, {}, &stats), err_ok);
+    ASSERT_EQ(stats.corpus, new_img.size() + 4 * (old_img.size() - 100));
+    ASSERT_GT(stats.memory, stats.corpus);
+
+    for (size_t i = 0; i < bases.size(); ++i) {
+        old_img = bases[i];
+        roundtrip();
+        ASSERT_EQ(len, lens[i]);
+        ASSERT_TRUE(std::equal(buf.begin(), buf.begin() + len, bufs[i].begin()));
+    }
+    outs.pop_back();
+    ASSERT_EQ(diff_batch(spans, new_img, outs), err_invalid_size);
+}
+
+TEST_F(Diff, BatchIdentical)
+{
+    std::mt19937 rng{11};
+
+    for (int round = 0; round < 300; ++round) {
+        std::vector<std::vector<byte>> bases(rng() % 4 + 1);
+        for (auto& it : bases) {
+            it.resize(rng() % 600);
+            for (auto& b : it)
+                b = rng() % 4; // NOTE: Small alphabet, so hashes collide and chains fill up
+        }
+        new_img.clear();
+        for (int n = rng() % 8; n; --n) {
+            auto& from = bases[rng() % bases.size()];
+            if (from.empty())
+                continue;
+            const size_t at = rng() % from.size();
+            new_img.insert(new_img.end(), from.begin() + at, from.begin() + at + std::min<size_t>(rng() % 100, from.size() - at));
+            new_img.push_back(rng());
+        }
+        const diff_params prm = {.max_chain = uint32_t(rng() % 4 + 1), .bits = int(rng() % 4 + 2), .self = bool(rng() & 1)};
+
+        std::vector<span> spans(bases.begin(), bases.end());
+        std::vector<std::vector<byte>> bufs(bases.size(), std::vector<byte>(4096));
+        std::vector<size_t> lens(bases.size());
+        std::vector<ref> outs;
+        for (size_t i = 0; i < bases.size(); ++i)
+            outs.emplace_back(bufs[i], lens[i]);
+        ASSERT_EQ(diff_batch(spans, new_img, outs, prm), err_ok);
+
+        for (size_t i = 0; i < bases.size(); ++i) {
+            old_img = bases[i];
+            roundtrip(prm);
+            ASSERT_EQ(len, lens[i]) << "round " << round << " base " << i;
+            ASSERT_TRUE(std::equal(buf.begin(), buf.begin() + len, bufs[i].begin())) << "round " << round << " base " << i;
+        }
+    }
+}
@@ -0,0 +1,86 @@
+#include <gtest/gtest.h>
+#include "dfu/dig.h"
+#include <random>
+#include <string_view>
+
+using namespace dfu;
+
+static span str(std::string_view s)
+{
+    return {reinterpret_cast<pointer>(s.data()), s.size()};
+}
+
+template<class H>
+static std::string hex(const H& h)
+{
+    std::string res;
+    for (auto it : h.value()) {
+        res += "0123456789abcdef"[it >> 4];
+        res += "0123456789abcdef"[it & 15];
+    }
+    return res;
+}
+
+TEST(Digest, Crc32c)
+{
+    crc32c crc;
+    crc.update(str("123456789"));
+    ASSERT_EQ(hex(crc), "839206e3");
+
+    static_assert(dig::crc32c_sw(~0u, span{}) == ~0u);
+}
+
+TEST(Digest, Sha256)
+{
+    sha256 sha;
+    ASSERT_EQ(hex(sha), "e3b0c44298fc1c149afbf4c8996fb92427ae41e4649b934ca495991b7852b855");
+    sha.update(str("abc"));
+    ASSERT_EQ(hex(sha), "ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad");
+
+    sha256 two;
+    two.update(str("abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq"));
+    ASSERT_EQ(hex(two), "248d6a61d20638b8e5c026930c3e6039a33ce45964ff2167f6ecedd419db06c1");
+}
+
+TEST(Digest, Streaming)
+{
+    std::mt19937 rng{9};
+    std::vector<byte> data(10000);
+    for (auto& it : data)
+        it = rng();
+
+    crc32c crc_one;
+    sha256 sha_one;
+    crc_one.update(data);
+    sha_one.update(data);
+
+    crc32c crc;
+    sha256 sha;
+    for (size_t done = 0, n; done < data.size(); done += n) {
+        n = std::min<size_t>(rng() % 200, data.size() - done);
+        crc.update({data.data() + done, n});
+        sha.update({data.data() + done, n});
+    }
+    ASSERT_EQ(crc.value(), crc_one.value());
+    ASSERT_EQ(sha.value(), sha_one.value());
+}
+
+TEST(Digest, HardwareMatchesPortable)
+{
+    std::mt19937 rng{11};
+    std::vector<byte> data(64 * 37 + 13);
+    for (auto& it : data)
+        it = rng();
+
+    if (dig::has_crc()) {
+        for (size_t len : {0, 1, 7, 8, 9, 1000, int(data.size())})
+            ASSERT_EQ(dig::crc32c_hw(~0u, {data.data(), len}), dig::crc32c_sw(~0u, {data.data(), len}));
+    }
+    if (dig::has_sha()) {
+        uint32_t a[8] = {1, 2, 3, 4, 5, 6, 7, 8};
+        uint32_t b[8] = {1, 2, 3, 4, 5, 6, 7, 8};
+        dig::sha256_hw(a, data.data(), data.size() / 64);
+        dig::sha256_sw(b, data.data(), data.size() / 64);
+        ASSERT_TRUE(std::equal(a, a + 8, b));
+    }
+}
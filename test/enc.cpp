@@ -118,6 +118,21 @@ TEST_F(Encode, OldOffset)
     });
 }
 
+TEST_F(Encode, NewCopy)
+{
+    codec.encode_cpy(1, 4);
+    codec.encode_cpy(31, 16);
+    codec.encode_cpy(32, 1);
+    codec.encode_cpy(0x1fffff, 17);
+
+    check(codec, {
+        0x33, 0x05, 0x00, // CPY[4] dist 1
+        0xf3, 0x7d, 0x00, // CPY[16] dist 31
+        0x03, 0x82, 0x00, 0x00, // CPY[1] dist 32
+        0x07, 0x01, 0xff, 0xff, 0x7f, 0x00, // CPY[17] dist 2097151
+    });
+}
+
 TEST_F(Encode, Failures)
 {
     const uint8_t test[76] = {};
@@ -128,6 +143,9 @@ TEST_F(Encode, Failures)
     ASSERT_EQ(codec.encode_arr({}, 1),          dfu::err_invalid_size);
     ASSERT_EQ(codec.encode_arr({0x00}, 0),      dfu::err_invalid_size);
     ASSERT_EQ(codec.encode_arr({0x00}, 257),    dfu::err_invalid_size);
+    ASSERT_EQ(codec.encode_off(0x20000000, 1),  dfu::err_invalid_size);
+    ASSERT_EQ(codec.encode_cpy(0, 1),           dfu::err_invalid_size);
+    ASSERT_EQ(codec.encode_cpy(0x200000, 1),    dfu::err_invalid_size);
     
     check(codec, {});
 }
@@ -156,3 +174,41 @@ TEST_F(Encode, ConstexprMixed)
         0xf7, 0x3f, 0x05, 0x80,         // OLD[1024] offs -8191 
     });
 }
+
+TEST_F(Encode, ConstevalBuild)
+{
+    static constexpr auto patch = dfu::build([](auto& c)
+    {
+        const uint8_t test[17] = {0xde, 0xad, 0xbe, 0xef};
+        c.encode_raw({0x55, 0x66, 0x77});
+        c.encode_rep(0x42, 100);
+        c.encode_rep(0x66, 1);
+        c.encode_arr({0x01, 0x02, 0x03}, 1);
+        c.encode_arr(test, 256);
+        c.encode_off(-8191, 1024);
+        c.encode_cpy(3, 10);
+    });
+    static_assert(std::is_same_v<decltype(patch), const std::array<uint8_t, 41>>);
+    static_assert(dfu::validate(patch) == dfu::err_ok);
+
+    static constexpr auto empty = dfu::build([](auto&) {});
+    static_assert(empty.size() == 0);
+
+    static constexpr auto large = dfu::build<8192>([](auto& c)
+    {
+        const uint8_t test[5000] = {};
+        c.encode_raw(test);
+    });
+    static_assert(large.size() == 5003);
+
+    codec.encode_raw({0x55, 0x66, 0x77});
+    codec.encode_rep(0x42, 100);
+    codec.encode_rep(0x66, 1);
+    codec.encode_arr({0x01, 0x02, 0x03}, 1);
+    codec.encode_arr(std::array<uint8_t, 17>{0xde, 0xad, 0xbe, 0xef}, 256);
+    codec.encode_off(-8191, 1024);
+    codec.encode_cpy(3, 10);
+
+    ASSERT_EQ(codec.size(), patch.size());
+    ASSERT_TRUE(std::equal(patch.begin(), patch.end(), codec.data()));
+}
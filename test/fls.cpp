@@ -0,0 +1,169 @@
+#include <gtest/gtest.h>
+#include "dfu/fls.h"
+#include "dfu/dif.h"
+#include <random>
+
+using namespace dfu;
+
+class Flash : public ::testing::Test {
+protected:
+    void SetUp() override
+    {
+        std::mt19937 rng{1};
+        old.resize(16384);
+        for (auto& it : old)
+            it = rng();
+        std::fill_n(old.begin() + 8192, 4096, 0xff);   // NOTE: Erased area in old image
+        img = old;
+        for (size_t i = 0; i < 32; ++i)
+            img[rng() % 8192] = rng();
+        std::fill_n(img.begin() + 1000, 2000, 0xff);    // NOTE: Code shrunk, rest left erased
+    }
+    std::vector<byte> patch(const diff_params& prm)
+    {
+        std::vector<byte> buf(65536);
+        size_t len = 0;
+        EXPECT_EQ(diff(old, img, ref{buf, len}, prm), err_ok);
+        buf.resize(len);
+        return buf;
+    }
+    flash_stats run(seq s, bool elide, std::chrono::nanoseconds& time)
+    {
+        sim_flash sim{old, img.size(), 1024};
+        flash_writer wr{sim, img.size(), 0xff, elide};
+        EXPECT_EQ(apply(s, wr), err_ok);
+        EXPECT_EQ(wr.size(), img.size());
+        EXPECT_TRUE(std::ranges::equal(sim.image(), img));
+        time = sim.elapsed();
+        return wr.stats();
+    }
+protected:
+    std::vector<byte> old;
+    std::vector<byte> img;
+};
+
+TEST_F(Flash, Chunks)
+{
+    byte data[40];
+    std::fill_n(data, 40, 0xff);
+    data[0] = 0x01;
+    data[2] = 0x02;
+    data[5] = 0x03;
+    data[39] = 0x04;
+
+    dfu::codec<256> codec;
+    codec.encode_rep(0xff, 100);
+    codec.encode_raw(data);
+    codec.encode_rep(0x00, 10);
+    codec.encode_raw(span{data}.subspan(1, 4));
+
+    sim_flash sim{old, 256, 64};
+    flash_writer wr{sim, 256};
+
+    ASSERT_EQ(apply(codec, wr), err_ok);
+    ASSERT_EQ(wr.size(), 154);
+
+    std::vector<byte> exp(100, 0xff);
+    exp.insert(exp.end(), data, data + 40);
+    exp.insert(exp.end(), 10, 0x00);
+    exp.insert(exp.end(), data + 1, data + 5);
+    EXPECT_TRUE(std::ranges::equal(sim.image().first(154), exp));
+
+    EXPECT_EQ(wr.stats().erases, 3);
+    EXPECT_EQ(wr.stats().programs, 4);  // NOTE: Short erased runs inside data[0..6) are programmed
+    EXPECT_EQ(wr.stats().skipped, 100 + 33 + 3);
+    EXPECT_EQ(wr.stats().programmed + wr.stats().skipped, 154);
+}
+
+TEST_F(Flash, PreErased)
+{
+    sim_flash sim{old, 256, 64};
+    flash_writer wr{sim, 256};
+    wr.mark_erased(0, 256);
+    ASSERT_EQ(sim.erase(0), err_ok);
+    ASSERT_EQ(sim.erase(64), err_ok);
+    ASSERT_EQ(sim.erase(128), err_ok);
+    ASSERT_EQ(sim.erase(192), err_ok);
+
+    dfu::codec<64> codec;
+    codec.encode_rep(0xff, 200);
+    codec.encode_raw({0x12, 0x34});
+
+    ASSERT_EQ(apply(codec, wr), err_ok);
+    EXPECT_EQ(wr.stats().erases, 0);
+    EXPECT_EQ(wr.stats().programs, 1);
+    EXPECT_EQ(wr.stats().programmed, 2);
+    EXPECT_EQ(sim.image()[200], 0x12);
+}
+
+TEST_F(Flash, Elision)
+{
+    auto plain = patch({});
+    diff_params prm;
+    prm.erased = 0xff;
+    auto pref = patch(prm);
+
+    std::chrono::nanoseconds base, t1, t2;
+    auto s0 = run(plain, false, base);
+    auto s1 = run(plain, true, t1);
+    auto s2 = run(pref, true, t2);
+
+    EXPECT_EQ(s0.skipped, 0);
+    EXPECT_EQ(s0.programmed, img.size());
+    EXPECT_GE(s1.skipped, 2000);
+    EXPECT_GE(s2.skipped, s1.skipped);
+    EXPECT_EQ(s0.erases, s2.erases);
+    EXPECT_LT(t1, base);
+    EXPECT_LE(t2, t1);
+}
+
+TEST_F(Flash, PreferErased)
+{
+    std::vector<byte> from(4096, 0xff);
+    std::vector<byte> to(4096, 0xff);
+    to[0] = 0x00;
+
+    diff_params prm;
+    prm.erased = 0xff;
+
+    std::vector<byte> buf(256);
+    size_t len = 0;
+    ASSERT_EQ(diff(from, to, ref{buf, len}, prm), err_ok);
+
+    size_t reps = 0, offs = 0;
+    for (auto it : seq{buf.data(), len}) {
+        reps += it.type == type_rep && it.rep == 0xff;
+        offs += it.type == type_off;
+    }
+    EXPECT_EQ(reps, 1);
+    EXPECT_EQ(offs, 0);
+}
+
+TEST_F(Flash, Failures)
+{
+    sim_flash sim{old, 100, 64};
+    flash_writer wr{sim, 100};
+
+    dfu::codec<64> codec;
+    codec.encode_rep(0xff, 129);
+    EXPECT_EQ(apply(codec, wr), err_no_memory);
+    codec.clear();
+    codec.encode_rep(0xff, 128);   // NOTE: Fits rounded up pages, but not partition
+    EXPECT_EQ(apply(codec, wr), err_no_memory);
+    codec.clear();
+    codec.encode_raw({0x01});
+    codec.encode_rep(0xff, 100);
+    EXPECT_EQ(apply(codec, wr), err_no_memory);
+    EXPECT_EQ(wr.size(), 1);
+
+    flash_writer full{sim, 100};
+    codec.clear();
+    codec.encode_rep(0xff, 100);
+    EXPECT_EQ(apply(codec, full), err_ok);
+    EXPECT_EQ(full.size(), 100);
+
+    byte tmp[4];
+    EXPECT_EQ(wr.read_new(0, tmp, 4), err_out_of_bounds);
+    EXPECT_EQ(sim.erase(1), err_out_of_bounds);
+    EXPECT_EQ(sim.program(99, tmp, 2), err_out_of_bounds);
+}
@@ -0,0 +1,210 @@
+#include <gtest/gtest.h>
+#include "dfu/opt.h"
+#include "dfu/dif.h"
+#include "dfu/app.h"
+#include <random>
+
+using namespace dfu;
+
+class Reoptimize : public ::testing::Test {
+protected:
+    static std::vector<byte> run(span old, seq s)
+    {
+        std::vector<byte> res(65536);
+        memory dev{old, res};
+        EXPECT_EQ(apply(seq{s.data(), s.size(), ext_cpy}, dev), err_ok);
+        res.resize(dev.size());
+        return res;
+    }
+    static size_t count(seq s, chunk_type t)
+    {
+        size_t n = 0;
+        for (auto it : seq{s.data(), s.size(), ext_cpy})
+            n += it.type == t;
+        return n;
+    }
+    void check(span old, seq s)
+    {
+        len = 0;
+        ASSERT_EQ(reoptimize(seq{s.data(), s.size(), ext_cpy}, old, ref{buf, len}, &stats), err_ok);
+        ASSERT_EQ(validate(result()), err_ok);
+        ASSERT_EQ(run(old, result()), run(old, s));
+        ASSERT_EQ(stats.input, s.size());
+        ASSERT_EQ(stats.output, len);
+        ASSERT_LE(len, s.size());
+    }
+    seq result() const { return {buf.data(), len, ext_cpy}; }
+protected:
+    std::vector<byte> buf = std::vector<byte>(65536);
+    size_t len = 0;
+    opt_stats stats;
+};
+
+TEST_F(Reoptimize, Chunks)
+{
+    const byte old[16] = {0x10, 0x11, 0x12, 0x13, 0x14, 0x15, 0x16, 0x17, 0x18, 0x19, 0x1a, 0x1b, 0x1c, 0x1d, 0x1e, 0x1f};
+
+    dfu::codec<256> codec;
+    codec.encode_raw({0x01});
+    codec.encode_raw({0x02, 0x03});             // Adjacent RAW
+    codec.encode_off(3, 2);                     // Short OFF, cheaper inline
+    codec.encode_raw({0x77, 0x77, 0x77, 0x77, 0x77, 0x77, 0x77, 0x77});  // REP hidden in RAW
+    codec.encode_raw({0xa, 0xb, 0xc, 0xa, 0xb, 0xc, 0xa, 0xb, 0xc, 0xa, 0xb, 0xc, 0xa, 0xb, 0xc});   // ARR hidden in RAW
+    codec.encode_rep(0x55, 20);
+    codec.encode_rep(0x55, 30);                 // Same REP
+    codec.encode_cpy(10, 5);
+    codec.encode_cpy(10, 5);                    // Same CPY
+    codec.encode_rep(0x66, 1);                  // Tiny REP
+    codec.encode_raw({0x99});
+
+    check(old, codec);
+
+    EXPECT_GT(stats.saved(), 0);
+    EXPECT_EQ(count(result(), type_off), 0);
+    EXPECT_EQ(count(result(), type_rep), 2);
+    EXPECT_EQ(count(result(), type_arr), 1);
+    EXPECT_EQ(count(result(), type_cpy), 1);
+}
+
+TEST_F(Reoptimize, WithoutOld)
+{
+    dfu::codec<64> codec;
+    codec.encode_raw({0x01, 0x02});
+    codec.encode_off(3, 2);
+    codec.encode_off(3, 2);
+    codec.encode_raw({0x03});
+
+    len = 0;
+    ASSERT_EQ(reoptimize(codec, ref{buf, len}, &stats), err_ok);
+    EXPECT_EQ(count(result(), type_off), 1);
+    EXPECT_EQ(count(result(), type_raw), 2);
+    EXPECT_EQ(stats.saved(), 2);
+}
+
+TEST_F(Reoptimize, Diff)
+{
+    std::mt19937 rng{1};
+    std::vector<byte> old(8192);
+    for (auto& it : old)
+        it = rng();
+    auto img = old;
+    for (size_t i = 0; i < 40; ++i)
+        img[rng() % img.size()] = rng();
+    std::fill_n(img.begin() + 4000, 300, 0xff);
+
+    std::vector<byte> tmp(65536);
+    size_t tmp_len = 0;
+    ASSERT_EQ(diff(old, img, ref{tmp, tmp_len}), err_ok);
+    seq s{tmp.data(), tmp_len};
+
+    check(old, s);
+    EXPECT_EQ(run(old, result()), img);
+    EXPECT_GE(stats.saved(), 0);
+}
+
+TEST_F(Reoptimize, Idempotent)
+{
+    dfu::codec<256> codec;
+    codec.encode_raw({0x01, 0x02, 0x03, 0x04, 0x04, 0x04, 0x04, 0x04, 0x04});
+    codec.encode_arr({0x01, 0x02}, 2);
+    codec.encode_rep(0x00, 100);
+    codec.encode_off(3, 50);
+
+    const byte old[256] = {};
+
+    check(old, codec);
+    auto first = std::vector<byte>(buf.begin(), buf.begin() + len);
+    check(old, seq{first.data(), first.size()});
+    EXPECT_EQ(stats.saved(), 0);
+}
+
+TEST_F(Reoptimize, Random)
+{
+    std::mt19937 rng{3};
+    std::vector<byte> old(4096);
+    for (auto& it : old)
+        it = rng();
+
+    for (int round = 0; round < 2000; ++round) {
+        std::vector<byte> tmp(4096);
+        size_t tmp_len = 0;
+        ref codec{tmp, tmp_len};
+        size_t pos = 0;
+
+        for (int n = rng() % 12 + 1; n; --n) {
+            const size_t len = rng() % 12 + 1;
+            byte data[12];
+            for (auto& it : data)
+                it = rng() % 3;
+            switch (rng() % 5)
+            {
+            case 0: codec.encode_raw({data, len}); break;
+            case 1: codec.encode_rep(data[0], len); break;
+            case 2: codec.encode_arr({data, rng() % 3 + 1}, len); break;
+            case 3: codec.encode_off(int32_t(rng() % (old.size() - 64)) - int32_t(pos), len); break;
+            default: 
+                if (pos)
+                    codec.encode_cpy(rng() % pos + 1, len);
+            }
+            pos = run(old, seq{tmp.data(), tmp_len}).size();
+        }
+        seq s{tmp.data(), tmp_len, ext_cpy};
+
+        check(old, s);
+        ASSERT_GE(stats.saved(), 0) << "round " << round;
+
+        len = 0;
+        ASSERT_EQ(reoptimize(s, ref{buf, len}, &stats), err_ok);
+        ASSERT_EQ(run(old, result()), run(old, s));
+        ASSERT_GE(stats.saved(), 0) << "round " << round;
+    }
+}
+
+TEST_F(Reoptimize, LongLiteral)
+{
+    std::vector<byte> data(10000);
+    for (size_t i = 0; i < data.size(); ++i)
+        data[i] = i * 7 + i / 256;
+
+    std::vector<byte> tmp(16384);
+    for (size_t run : {4, 5, 40}) {
+        std::fill_n(data.begin() + 5000, run, 0xaa); // NOTE: Splitting costs wider RAW headers on both sides
+
+        size_t tmp_len = 0;
+        ASSERT_EQ(ref(tmp, tmp_len).encode_raw(data), err_ok);
+
+        check({}, seq{tmp.data(), tmp_len});
+        ASSERT_GE(stats.saved(), 0) << "run " << run;
+        ASSERT_EQ(count(result(), type_rep), run > 5);
+    }
+}
+
+TEST_F(Reoptimize, MergeFoundRep)
+{
+    dfu::codec<64> codec;
+    codec.encode_rep(0x55, 20);
+    codec.encode_raw({0x55, 0x55, 0x55, 0x55, 0x55, 0x55, 0x01});
+
+    check({}, codec);
+    EXPECT_EQ(count(result(), type_rep), 1);
+    EXPECT_EQ(count(result(), type_raw), 1);
+}
+
+TEST_F(Reoptimize, Failures)
+{
+    const byte old[4] = {};
+
+    dfu::codec<64> codec;
+    codec.encode_off(-1, 2);
+    len = 0;
+    EXPECT_EQ(reoptimize(codec, old, ref{buf, len}), err_out_of_bounds);
+
+    const byte bad[] = {0x40, 0x01};
+    len = 0;
+    EXPECT_EQ(reoptimize(seq{bad, sizeof(bad)}, ref{buf, len}), err_out_of_bounds);
+
+    dfu::codec<64> big;
+    big.encode_raw({0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09});
+    len = 0;
+    EXPECT_EQ(reoptimize(big, ref{{buf.data(), 4}, len}), err_no_memory);
+}
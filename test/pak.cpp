@@ -0,0 +1,255 @@
+#include <gtest/gtest.h>
+#include "dfu/pak.h"
+#include "dfu/dif.h"
+#include "dfu/fls.h"
+#include <random>
+#include <thread>
+
+using namespace dfu;
+
+class Package : public ::testing::Test {
+protected:
+    void SetUp() override
+    {
+        std::mt19937 rng{13};
+        old_img.resize(3000);
+        for (auto& it : old_img)
+            it = rng();
+        new_img = old_img;
+        new_img.insert(new_img.begin() + 1500, 100, 0x77);
+        ASSERT_EQ(diff(old_img, new_img, ref{patch, patch_len}), err_ok);
+    }
+    err roundtrip(const package& pkg)
+    {
+        size_t len = 0;
+        EXPECT_EQ(pack(pkg, buf, len), err_ok);
+        auto [res, e] = unpack(span{buf.data(), len});
+        EXPECT_EQ(e, err_ok);
+        EXPECT_EQ(res.src, pkg.src);
+        EXPECT_EQ(res.dst, pkg.dst);
+        EXPECT_TRUE(std::equal(res.body.data(), res.body.data() + res.body.size(), pkg.body.data(), pkg.body.data() + pkg.body.size()));
+
+        out.assign(new_img.size(), 0);
+        memory dev{old_img, out};
+        return apply(res, dev);
+    }
+protected:
+    std::vector<byte> old_img;
+    std::vector<byte> new_img;
+    std::vector<byte> out;
+    std::vector<byte> patch = std::vector<byte>(4096);
+    std::vector<byte> buf = std::vector<byte>(4096);
+    size_t patch_len = 0;
+};
+
+TEST_F(Package, Verified)
+{
+    for (auto kind : {digest_crc32c, digest_sha256}) {
+        package pkg{digest_of(kind, old_img), digest_of(kind, new_img), seq{patch.data(), patch_len}};
+        ASSERT_EQ(roundtrip(pkg), err_ok);
+        ASSERT_EQ(out, new_img);
+    }
+    package pkg{{}, digest_of(digest_crc32c, new_img), seq{patch.data(), patch_len}};
+    ASSERT_EQ(roundtrip(pkg), err_ok);
+    pkg = {{}, {}, seq{patch.data(), patch_len}};
+    ASSERT_EQ(roundtrip(pkg), err_ok);
+    ASSERT_EQ(out, new_img);
+}
+
+TEST_F(Package, Mismatch)
+{
+    auto src = digest_of(digest_sha256, old_img);
+    auto dst = digest_of(digest_sha256, new_img);
+
+    src.val[0] ^= 1;
+    ASSERT_EQ(roundtrip({src, dst, seq{patch.data(), patch_len}}), err_mismatch);
+    src.val[0] ^= 1;
+    dst.size -= 1;
+    ASSERT_EQ(roundtrip({src, dst, seq{patch.data(), patch_len}}), err_mismatch);
+}
+
+TEST_F(Package, Failures)
+{
+    size_t len = 0;
+    package pkg{digest_of(digest_crc32c, old_img), {}, seq{patch.data(), patch_len}};
+    ASSERT_EQ(pack(pkg, std::span{buf}.first(patch_len + 9), len), err_no_memory);
+    ASSERT_EQ(pack(pkg, buf, len), err_ok);
+    ASSERT_EQ(len, patch_len + 14);
+
+    ASSERT_EQ(std::get<err>(unpack(span{buf.data(), 8})), err_out_of_bounds);
+    buf[3] = 2;
+    ASSERT_EQ(std::get<err>(unpack(span{buf.data(), len})), err_invalid_size);
+    buf[3] = 1;
+    buf[5] = 7;
+    ASSERT_EQ(std::get<err>(unpack(span{buf.data(), len})), err_invalid_size);
+}
+
+TEST_F(Package, Features)
+{
+    dfu::codec<64> body;
+    body.encode_raw({0x01, 0x02, 0x03});
+    body.encode_cpy(3, 6);
+
+    size_t len = 0;
+    ASSERT_EQ(pack(package{{}, {}, seq{patch.data(), patch_len}}, buf, len), err_ok);
+    ASSERT_EQ(buf[4] & pak::has_cpy, 0);
+    buf[4] |= 0x80;
+    ASSERT_EQ(std::get<err>(unpack(span{buf.data(), len})), err_invalid_size);
+
+    ASSERT_EQ(pack(package{{}, {}, seq{body.data(), body.size(), ext_cpy}}, buf, len), err_ok);
+    ASSERT_EQ(buf[4], pak::has_cpy);
+    auto second = [](seq s) { return *++s.begin(); };
+    auto [pkg, e] = unpack(span{buf.data(), len});
+    ASSERT_EQ(e, err_ok);
+    ASSERT_EQ(pkg.body.ext, ext_cpy);
+    ASSERT_EQ(second(pkg.body).type, type_cpy);
+
+    buf[4] = 0; // NOTE: Same bytes from producer unaware of CPY mean padded OFF
+    std::tie(pkg, e) = unpack(span{buf.data(), len});
+    ASSERT_EQ(e, err_ok);
+    ASSERT_EQ(pkg.body.ext, ext_none);
+    ASSERT_EQ(second(pkg.body).type, type_off);
+    ASSERT_EQ(second(pkg.body).off, 3);
+
+    ASSERT_EQ(pack(package{{}, {}, body}, buf, len), err_ok);
+    ASSERT_EQ(buf[4], 0);
+}
+
+class Sections : public ::testing::Test {
+protected:
+    void SetUp() override
+    {
+        std::mt19937 rng{7};
+        old_img.resize(3 * part);
+        for (auto& it : old_img)
+            it = rng();
+        for (size_t i = 0; i < 3; ++i) {
+            auto from = span{old_img}.subspan(i * part, part);
+            auto& to = new_imgs[i];
+            to.assign(from.begin(), from.end());
+            if (i != 1) // NOTE: Middle partition unchanged
+                to.insert(to.begin() + 100 * (i + 1), 50, byte(i));
+        }
+        std::vector<std::thread> workers; // NOTE: Sections are diffed in parallel
+        for (size_t i = 0; i < 3; ++i)
+            workers.emplace_back([this, i]() {
+                auto from = span{old_img}.subspan(i * part, part);
+                patch_lens[i] = 0;
+                EXPECT_EQ(diff(from, new_imgs[i], ref{patches[i], patch_lens[i]}), err_ok);
+                secs[i] = {byte(10 + i), uint32_t(i * part), uint32_t(new_imgs[i].size()),
+                    digest_of(digest_crc32c, from), digest_of(digest_sha256, new_imgs[i]), seq{patches[i].data(), patch_lens[i]}};
+            });
+        for (auto& it : workers)
+            it.join();
+    }
+    err run(const section& sec, size_t i)
+    {
+        outs[i].assign(new_imgs[i].size(), 0);
+        memory dev{old_img, outs[i]};
+        return apply(sec, dev);
+    }
+protected:
+    static constexpr size_t part = 1000;
+    std::vector<byte> old_img;
+    std::vector<byte> new_imgs[3];
+    std::vector<byte> outs[3];
+    std::vector<byte> patches[3] = {std::vector<byte>(4096), std::vector<byte>(4096), std::vector<byte>(4096)};
+    size_t patch_lens[3] = {};
+    section secs[3];
+    std::vector<byte> buf = std::vector<byte>(16384);
+};
+
+TEST_F(Sections, Roundtrip)
+{
+    size_t len = 0;
+    ASSERT_EQ(pack(secs, buf, len), err_ok);
+
+    section res[4];
+    auto [cnt, e] = unpack(span{buf.data(), len}, res);
+    ASSERT_EQ(e, err_ok);
+    ASSERT_EQ(cnt, 3);
+
+    for (size_t i : {2, 0}) { // NOTE: Any order, unchanged one skipped
+        EXPECT_EQ(res[i].part, 10 + i);
+        EXPECT_EQ(res[i].base, i * part);
+        EXPECT_EQ(res[i].src, secs[i].src);
+        EXPECT_EQ(res[i].dst, secs[i].dst);
+        ASSERT_EQ(run(res[i], i), err_ok);
+        EXPECT_EQ(outs[i], new_imgs[i]);
+    }
+    for (auto& sec : std::span{res, cnt}) // NOTE: Each body is complete sequence
+        ASSERT_EQ(validate(sec.body), err_ok);
+
+    size_t total = 0;
+    for (pointer p = res[1].body.data(), end = p + res[1].body.size(); p < end;) {
+        auto [cnk, e, next] = decode(p, end);
+        ASSERT_EQ(e, err_ok);
+        total += cnk.type == type_arr ? cnk.size * cnk.arr.reps : cnk.size;
+        p = next;
+    }
+    EXPECT_EQ(total, res[1].size);
+}
+
+TEST_F(Sections, Mismatch)
+{
+    section sec = secs[0];
+    sec.base = part;
+    ASSERT_EQ(run(sec, 0), err_mismatch);
+
+    sec = secs[0];
+    sec.src = {};
+    sec.dst = {};
+    sec.size += 1;
+    ASSERT_EQ(run(sec, 0), err_mismatch);
+}
+
+TEST_F(Sections, Overflow)
+{
+    dfu::codec<64> body;
+    body.encode_raw({0x01, 0x02, 0x03, 0x04});
+    body.encode_rep(0x05, 36);
+
+    std::vector<byte> res(64, 0xcc);
+    memory dev{old_img, res};
+    section sec{0, 0, 8, {}, {}, body};
+    ASSERT_EQ(apply(sec, dev), err_out_of_bounds);
+    ASSERT_EQ(dev.size(), 4);   // NOTE: Nothing past section reached device
+    ASSERT_EQ(res[8], 0xcc);
+}
+
+TEST_F(Sections, Fill)
+{
+    dfu::codec<64> body;
+    body.encode_raw({0x01, 0x02, 0x03, 0x04});
+    body.encode_rep(0xff, 1000);
+
+    std::vector<byte> img = {0x01, 0x02, 0x03, 0x04};
+    img.resize(1004, 0xff);
+
+    sim_flash sim{old_img, 1024, 256};
+    flash_writer wr{sim, 1024};
+    section sec{0, 0, 1004, {}, digest_of(digest_sha256, img), body};
+    ASSERT_EQ(apply(sec, wr), err_ok);
+    EXPECT_EQ(wr.stats().skipped, 1000); // NOTE: REP went through fill() of both adapters
+    EXPECT_EQ(wr.stats().programmed, 4);
+    EXPECT_TRUE(std::ranges::equal(sim.image().first(1004), img));
+}
+
+TEST_F(Sections, Failures)
+{
+    size_t len = 0;
+    ASSERT_EQ(pack(secs, std::span{buf}.first(100), len), err_no_memory);
+    ASSERT_EQ(pack(secs, buf, len), err_ok);
+
+    section res[3];
+    ASSERT_EQ(std::get<err>(unpack(span{buf.data(), len}, std::span{res, 2})), err_no_memory);
+    ASSERT_EQ(std::get<err>(unpack(span{buf.data(), 30}, res)), err_out_of_bounds);
+    ASSERT_EQ(std::get<err>(unpack(span{buf.data(), len - 1}, res)), err_out_of_bounds);
+
+    buf[3] = pak::version;
+    ASSERT_EQ(std::get<err>(unpack(span{buf.data(), len}, res)), err_invalid_size);
+    buf[3] = pak::sections;
+    buf[15] = 0; // NOTE: First stream offset into table
+    buf[16] = 0;
+    ASSERT_EQ(std::get<err>(unpack(span{buf.data(), len}, res)), err_invalid_size);
+}
@@ -0,0 +1,130 @@
+#include <gtest/gtest.h>
+#include "dfu/pkt.h"
+#include "dfu/dif.h"
+#include <random>
+
+using namespace dfu;
+
+class Packetize : public ::testing::Test {
+protected:
+    void SetUp() override
+    {
+        std::mt19937 rng{5};
+        old_img.resize(4096);
+        for (auto& it : old_img)
+            it = rng();
+        new_img = old_img;
+        new_img.erase(new_img.begin() + 300, new_img.begin() + 400);
+        new_img.insert(new_img.begin() + 1000, 200, 0x00);
+        for (int i = 0; i < 600; ++i)
+            new_img.insert(new_img.begin() + 2000 + i, rng());
+    }
+    void split(seq s, size_t mtu)
+    {
+        frames.clear();
+        auto emit = [&](span f) {
+            frames.emplace_back(f.begin(), f.end());
+            return err_ok;
+        };
+        ASSERT_EQ(packetize(s, mtu, emit, &stats), err_ok);
+        ASSERT_EQ(stats.frames, frames.size());
+        size_t total = 0;
+        for (auto& it : frames) {
+            ASSERT_LE(it.size(), mtu);
+            total += it.size();
+        }
+        ASSERT_EQ(stats.output, total);
+        ASSERT_EQ(stats.input, s.size());
+    }
+    std::vector<byte> run(const std::vector<size_t>& order, size_t size)
+    {
+        std::vector<byte> res(size);
+        memory dev{old_img, res};
+        for (auto i : order)
+            EXPECT_EQ(apply_frame(frames[i], dev, ext), err_ok);
+        return res;
+    }
+protected:
+    std::vector<byte> old_img;
+    std::vector<byte> new_img;
+    std::vector<std::vector<byte>> frames;
+    pkt_stats stats;
+    extension ext = ext_none;
+};
+
+TEST_F(Packetize, Diff)
+{
+    std::vector<byte> buf(8192);
+    size_t len = 0;
+    ASSERT_EQ(diff(old_img, new_img, ref{buf, len}), err_ok);
+
+    split(seq{buf.data(), len}, 64);
+    ASSERT_GT(stats.frames, 600 / 64);
+    ASSERT_LT(stats.overhead(), stats.frames * (pkt::head_len + 2));
+
+    std::vector<size_t> order(frames.size());
+    for (size_t i = 0; i < order.size(); ++i)
+        order[i] = i;
+    ASSERT_EQ(run(order, new_img.size()), new_img);
+
+    order.push_back(order.size() / 2);
+    order.push_back(1);
+    ASSERT_EQ(run(order, new_img.size()), new_img);
+}
+
+TEST_F(Packetize, OutOfOrder)
+{
+    std::vector<byte> buf(8192);
+    size_t len = 0;
+    ASSERT_EQ(diff(old_img, new_img, ref{buf, len}, {.self = false}), err_ok);
+
+    split(seq{buf.data(), len}, 100);
+
+    std::vector<size_t> order(frames.size());
+    for (size_t i = 0; i < order.size(); ++i)
+        order[i] = order.size() - 1 - i;
+    ASSERT_EQ(run(order, new_img.size()), new_img);
+}
+
+TEST_F(Packetize, Chunks)
+{
+    const byte test[40] = {0xde, 0xad, 0xbe, 0xef};
+    dfu::codec<128> codec;
+    codec.encode_raw({0x01, 0x02, 0x03});
+    codec.encode_arr(test, 3);
+    codec.encode_arr({0x55, 0x66}, 100);
+    codec.encode_rep(0x42, 5000);
+    codec.encode_off(-5000, 100);
+    codec.encode_cpy(3, 10);
+
+    ext = ext_cpy;
+    split(seq{codec.data(), codec.size(), ext}, 16);
+
+    for (auto& it : frames) {
+        seq s{it.data() + pkt::head_len, it.size() - pkt::head_len, ext};
+        for (auto c : s)
+            ASSERT_NE(c.type, type_invalid);
+    }
+    std::vector<size_t> order(frames.size());
+    for (size_t i = 0; i < order.size(); ++i)
+        order[i] = i;
+
+    std::vector<byte> exp(6000);
+    memory dev{old_img, exp};
+    ASSERT_EQ(apply(seq{codec.data(), codec.size(), ext}, dev), err_ok);
+    exp.resize(dev.size());
+    ASSERT_EQ(run(order, exp.size()), exp);
+}
+
+TEST_F(Packetize, Failures)
+{
+    dfu::codec<16> codec;
+    codec.encode_raw({0x01, 0x02});
+    auto emit = [](span) { return err_no_memory; };
+
+    ASSERT_EQ(packetize(codec, pkt::min_mtu - 1, emit), err_invalid_size);
+    ASSERT_EQ(packetize(codec, pkt::min_mtu, emit), err_no_memory);
+
+    codec.resize(codec.size() - 1);
+    ASSERT_EQ(packetize(codec, pkt::min_mtu, [](span) { return err_ok; }), err_out_of_bounds);
+}
@@ -0,0 +1,146 @@
+#include <gtest/gtest.h>
+#include "dfu/sgl.h"
+#include "dfu/dif.h"
+#include "dfu/app.h"
+#include <cstdio>
+#include <random>
+#include <unistd.h>
+
+using namespace dfu;
+
+class Gather : public ::testing::Test {
+protected:
+    static std::vector<byte> flat(const sglist& sgl)
+    {
+        std::vector<byte> res;
+        for (auto it : sgl.segments())
+            res.insert(res.end(), it.data, it.data + it.size);
+        return res;
+    }
+    static bool inside(pointer p, span mem)
+    {
+        return p >= mem.data() && p < mem.data() + mem.size();
+    }
+protected:
+    sglist sgl;
+};
+
+TEST_F(Gather, Chunks)
+{
+    const byte old[8] = {0x10, 0x11, 0x12, 0x13, 0x14, 0x15, 0x16, 0x17};
+    const byte big[80] = {0xde, 0xad};
+
+    dfu::codec<256> codec;
+    codec.encode_raw({0x55, 0x66});
+    codec.encode_rep(0x42, 5000);
+    codec.encode_arr({0x01, 0x02}, 2);
+    codec.encode_arr(big, 2);
+    codec.encode_off(-5166, 3);
+    codec.encode_cpy(200, 100);
+    codec.encode_cpy(3, 10);
+
+    const seq s{codec.data(), codec.size(), ext_cpy};
+    ASSERT_EQ(gather(s, old, sgl), err_ok);
+
+    std::vector<byte> exp(6000);
+    memory dev{old, exp};
+    ASSERT_EQ(apply(s, dev), err_ok);
+    exp.resize(dev.size());
+
+    ASSERT_EQ(sgl.size(), exp.size());
+    ASSERT_EQ(flat(sgl), exp);
+    ASSERT_EQ(sgl.arena(), sglist::block + 4 + 10);
+
+    const auto& segs = sgl.segments();
+    ASSERT_TRUE(inside(segs[0].data, codec));
+    ASSERT_TRUE(inside(segs[4].data, codec));
+    ASSERT_EQ(segs[4].data, segs[5].data);
+}
+
+TEST_F(Gather, Diff)
+{
+    std::mt19937 rng{17};
+    std::vector<byte> old_img(20000);
+    for (auto& it : old_img)
+        it = rng();
+    auto new_img = old_img;
+    new_img.erase(new_img.begin() + 700, new_img.begin() + 900);
+    new_img.insert(new_img.begin() + 5000, 3000, 0xff);
+    new_img.insert(new_img.begin() + 15000, new_img.begin() + 100, new_img.begin() + 1100);
+    for (int i = 0; i < 500; ++i)
+        new_img.insert(new_img.begin() + 12000 + i, rng());
+
+    std::vector<byte> patch(65536);
+    size_t len = 0;
+    ASSERT_EQ(diff(old_img, new_img, ref{patch, len}, {.self = true}), err_ok);
+    ASSERT_EQ(gather(seq{patch.data(), len, ext_cpy}, old_img, sgl), err_ok);
+    ASSERT_EQ(flat(sgl), new_img);
+    ASSERT_LE(sgl.arena(), sglist::block);
+
+    size_t copied = 0;
+    for (auto it : sgl.segments())
+        if (!inside(it.data, span{patch.data(), len}) && !inside(it.data, old_img))
+            copied += it.size;
+    ASSERT_EQ(copied, 3000);
+}
+
+TEST_F(Gather, LongCopy)
+{
+    std::vector<byte> data(5000);
+    for (size_t i = 0; i < data.size(); ++i)
+        data[i] = i * 7;
+
+    std::vector<byte> buf(8192);
+    size_t len = 0;
+    ref codec{buf, len};
+    codec.encode_raw({0x01, 0x02, 0x03});
+    codec.encode_cpy(3, 1 << 24);       // NOTE: 16 MiB of period 3
+    codec.encode_raw(data);
+    codec.encode_cpy(data.size(), 100000);
+
+    const byte old[1] = {};
+    ASSERT_EQ(gather(seq{buf.data(), len, ext_cpy}, old, sgl), err_ok);
+
+    std::vector<byte> exp(sgl.size());
+    memory dev{old, exp};
+    ASSERT_EQ(apply(seq{buf.data(), len, ext_cpy}, dev), err_ok);
+    ASSERT_EQ(dev.size(), 3 + (1 << 24) + 5000 + 100000);
+    ASSERT_EQ(flat(sgl), exp);
+
+    ASSERT_LE(sgl.arena(), sglist::block);
+    ASSERT_LE(sgl.segments().size(), (1 << 24) / (sglist::block - 3) + 100000 / 5000 + 4);
+
+#if DFU_SGL_IOVEC
+    ASSERT_GT(sgl.segments().size(), sglist::iov_max); // NOTE: Too many for single writev()
+
+    FILE* f = std::tmpfile();
+    ASSERT_NE(f, nullptr);
+    ASSERT_EQ(sgl.write(fileno(f)), err_ok);
+    std::rewind(f);
+    std::vector<byte> res(exp.size() + 1);
+    ASSERT_EQ(std::fread(res.data(), 1, res.size(), f), exp.size());
+    std::fclose(f);
+    res.pop_back();
+    ASSERT_EQ(res, exp);
+#endif
+}
+
+TEST_F(Gather, Failures)
+{
+    const byte old[4] = {};
+    dfu::codec<16> codec;
+
+    codec.encode_off(1, 4);
+    ASSERT_EQ(gather(codec, old, sgl), err_out_of_bounds);
+
+    sgl.clear();
+    codec.clear();
+    codec.encode_cpy(1, 1);
+    ASSERT_EQ(gather(seq{codec.data(), codec.size(), ext_cpy}, old, sgl), err_out_of_bounds);
+
+    sgl.clear();
+    codec.clear();
+    codec.encode_raw({0x00, 0x11});
+    codec.resize(codec.size() - 1);
+    ASSERT_EQ(gather(codec, old, sgl), err_out_of_bounds);
+}